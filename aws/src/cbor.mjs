@@ -0,0 +1,171 @@
+// minimal CBOR (RFC 8949) codec, definite lengths only
+
+export function encodeCbor(value) {
+  const chunks = [];
+  writeValue(chunks, value);
+  return Buffer.concat(chunks);
+}
+
+export function decodeCbor(data) {
+  const buffer = Buffer.from(data);
+  const state = { offset: 0 };
+  const value = readValue(buffer, state);
+
+  if (state.offset !== buffer.length) {
+    throw new Error("Trailing bytes after CBOR item.");
+  }
+  return value;
+}
+
+function writeHead(chunks, major, argument) {
+  const head = Buffer.alloc(9);
+  let length = 1;
+
+  if (argument < 24) {
+    head[0] = argument;
+  } else if (argument <= 0xff) {
+    head[0] = 24;
+    head.writeUInt8(argument, 1);
+    length = 2;
+  } else if (argument <= 0xffff) {
+    head[0] = 25;
+    head.writeUInt16BE(argument, 1);
+    length = 3;
+  } else if (argument <= 0xffffffff) {
+    head[0] = 26;
+    head.writeUInt32BE(argument, 1);
+    length = 5;
+  } else {
+    head[0] = 27;
+    head.writeBigUInt64BE(BigInt(argument), 1);
+    length = 9;
+  }
+
+  head[0] |= major << 5;
+  chunks.push(head.subarray(0, length));
+}
+
+function writeValue(chunks, value) {
+  if (value === null || value === undefined) {
+    chunks.push(Buffer.from([0xf6]));
+  } else if (typeof value === "boolean") {
+    chunks.push(Buffer.from([value ? 0xf5 : 0xf4]));
+  } else if (typeof value === "number" && Number.isInteger(value)) {
+    if (value >= 0) writeHead(chunks, 0, value);
+    else writeHead(chunks, 1, -1 - value);
+  } else if (typeof value === "number") {
+    const encoded = Buffer.alloc(9);
+    encoded[0] = 0xfb;
+    encoded.writeDoubleBE(value, 1);
+    chunks.push(encoded);
+  } else if (typeof value === "string") {
+    const text = Buffer.from(value, "utf8");
+    writeHead(chunks, 3, text.length);
+    chunks.push(text);
+  } else if (value instanceof Uint8Array) {
+    writeHead(chunks, 2, value.length);
+    chunks.push(Buffer.from(value));
+  } else if (Array.isArray(value)) {
+    writeHead(chunks, 4, value.length);
+    value.forEach((item) => writeValue(chunks, item));
+  } else {
+    const entries = Object.entries(value);
+    writeHead(chunks, 5, entries.length);
+    for (const [key, item] of entries) {
+      writeValue(chunks, key);
+      writeValue(chunks, item);
+    }
+  }
+}
+
+function readArgument(buffer, state, info) {
+  if (info < 24) return info;
+
+  const offset = state.offset;
+  switch (info) {
+    case 24:
+      state.offset += 1;
+      return buffer.readUInt8(offset);
+    case 25:
+      state.offset += 2;
+      return buffer.readUInt16BE(offset);
+    case 26:
+      state.offset += 4;
+      return buffer.readUInt32BE(offset);
+    case 27:
+      state.offset += 8;
+      return Number(buffer.readBigUInt64BE(offset));
+    default:
+      throw new Error("Unsupported CBOR length encoding.");
+  }
+}
+
+function readValue(buffer, state) {
+  const initial = buffer.readUInt8(state.offset++);
+  const major = initial >> 5;
+  const info = initial & 0x1f;
+
+  if (major === 7) {
+    switch (info) {
+      case 20:
+        return false;
+      case 21:
+        return true;
+      case 22:
+      case 23:
+        return null;
+      case 25:
+        state.offset += 2;
+        return readHalf(buffer.readUInt16BE(state.offset - 2));
+      case 26:
+        state.offset += 4;
+        return buffer.readFloatBE(state.offset - 4);
+      case 27:
+        state.offset += 8;
+        return buffer.readDoubleBE(state.offset - 8);
+      default:
+        throw new Error("Unsupported CBOR simple value.");
+    }
+  }
+
+  const argument = readArgument(buffer, state, info);
+
+  switch (major) {
+    case 0:
+      return argument;
+    case 1:
+      return -1 - argument;
+    case 2:
+    case 3: {
+      if (state.offset + argument > buffer.length) {
+        throw new Error("Truncated CBOR string.");
+      }
+      const data = buffer.subarray(state.offset, state.offset + argument);
+      state.offset += argument;
+      return major === 2 ? data : data.toString("utf8");
+    }
+    case 4:
+      return Array.from({ length: argument }, () => readValue(buffer, state));
+    case 5: {
+      const map = {};
+      for (let i = 0; i < argument; i++) {
+        const key = readValue(buffer, state);
+        map[key] = readValue(buffer, state);
+      }
+      return map;
+    }
+    default:
+      // tags are ignored, the tagged value is returned
+      return readValue(buffer, state);
+  }
+}
+
+function readHalf(bits) {
+  const exponent = (bits >> 10) & 0x1f;
+  const mantissa = bits & 0x3ff;
+  const sign = bits & 0x8000 ? -1 : 1;
+
+  if (exponent === 0) return sign * mantissa * 2 ** -24;
+  if (exponent === 31) return mantissa ? NaN : sign * Infinity;
+  return sign * (1 + mantissa / 1024) * 2 ** (exponent - 15);
+}
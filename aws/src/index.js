@@ -12,6 +12,7 @@ import {
 } from "@aws-sdk/client-iot-data-plane";
 import { IOT_CERT_PREFIX, IOT_ENDPOINT, IOT_POLICY_NAME } from "./config.mjs";
 import { verifyCSR } from "./csr.mjs";
+import { decodeCbor, encodeCbor } from "./cbor.mjs";
 
 const iotClient = new IoTClient({ region: "eu-west-1" });
 
@@ -19,13 +20,24 @@ const iotDataclient = new IoTDataPlaneClient({
   endpoint: "https://" + IOT_ENDPOINT,
 });
 
-export const handler = async (event) => {
-  console.log(event);
+export const handler = async (rawEvent) => {
+  console.log(rawEvent);
+  const event = decodeEvent(rawEvent);
 
   if ("certificateId" in event && "refresh" in event) {
     await handleCertificateExpiring(event.certificateId);
   }
 
+  if (event.cbor) {
+    // one rule forwards every cbor management topic, the topic tells them apart
+    if (event.topic.endsWith("/csr_res/cbor") && "csr" in event) {
+      await handleSignCsr(event);
+    } else if (event.topic.endsWith("/crt_ack/cbor") && "certificateId" in event) {
+      await handleCertificateAck(event);
+    }
+    return;
+  }
+
   if ("clientid" in event && "csr" in event) {
     await handleSignCsr(event);
   }
@@ -37,10 +49,11 @@ export const handler = async (event) => {
 
 async function handleSignCsr(event) {
   // csr response
-  const { clientid, csr, register, manual } = event;
+  const { clientid, csr, register, manual, cbor } = event;
 
-  // generate crt from csr
-  const certificatePem = await verifyCSR(csr);
+  // generate crt from csr, cbor devices send it as der
+  const csrPem = cbor ? derToPem(csr, "CERTIFICATE REQUEST") : csr;
+  const certificatePem = await verifyCSR(csrPem);
 
   if (register) {
     // register new certificate
@@ -61,6 +74,12 @@ async function handleSignCsr(event) {
   if (manual) {
     // return from manual invocation
     return certificatePem;
+  } else if (cbor) {
+    // answer in the encoding used by the device
+    await mqttPublish(
+      `management/${clientid}/crt/cbor`,
+      encodeCbor({ certificateDer: pemToDer(certificatePem) })
+    );
   } else {
     // send new certificate to device
     await mqttPublish(
@@ -132,3 +151,32 @@ async function mqttPublish(topic, payload) {
   const response = await iotDataclient.send(command);
   return response;
 }
+
+// payloads on topics ending in /cbor (or with a cbor content type) reach the
+// function base64 encoded, e.g. with the rule
+// SELECT encode(*, 'base64') AS payload, topic() AS topic, clientid() AS clientid,
+//   principal() AS certificateId
+// FROM 'management/+/+/cbor'
+// principal() is the id of the certificate the device connected with; the
+// crt_ack path needs it to know which certificate to keep, csr_res ignores it
+function decodeEvent(event) {
+  const isCbor =
+    event.topic?.endsWith("/cbor") || event.contentType === "application/cbor";
+
+  if (!isCbor || typeof event.payload !== "string") {
+    return event;
+  }
+
+  const { payload, ...rest } = event;
+  return { ...rest, ...decodeCbor(Buffer.from(payload, "base64")), cbor: true };
+}
+
+function derToPem(der, label) {
+  const body = Buffer.from(der).toString("base64").match(/.{1,64}/g).join("\n");
+  return `-----BEGIN ${label}-----\n${body}\n-----END ${label}-----\n`;
+}
+
+function pemToDer(pem) {
+  const body = pem.replace(/-----(BEGIN|END) [^-]+-----/g, "").replace(/\s+/g, "");
+  return Buffer.from(body, "base64");
+}
@@ -0,0 +1,14 @@
+#ifndef PUF_ECC_H
+#define PUF_ECC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Repetition code decoder used by get_puf_response, exported so the application can benchmark it.
+ * See ecc.h for the description of the parameters.
+ * @return the number of bits corrected
+ */
+int correct_data(const uint8_t *masked_data, const uint8_t *ecc_data, size_t len, uint8_t *result, size_t res_len);
+
+#endif
@@ -0,0 +1,204 @@
+#include "bench/bench.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/pk.h"
+
+#include "crypto/crypto.h"
+#include "net/tls_transport.h"
+#include "define.h"
+#include "puf_sec.h"
+#include "puf_ecc.h"
+
+static const char *TAG = "Bench";
+
+/* helper data of one 32 bytes response, 8x repetition code */
+#define BENCH_ECC_LENGTH 256
+#define BENCH_RESPONSE_LENGTH (BENCH_ECC_LENGTH / 8)
+#define BENCH_SEED_LENGTH 32
+#define BENCH_CSR_MAX_LEN 500
+#define BENCH_TLS_TIMEOUT_MS 5000
+
+typedef struct BenchStage
+{
+    const char *name;
+    ErrorCode (*setup)(void); /* optional, not timed */
+    ErrorCode (*run)(void);
+    void (*teardown)(void); /* optional, not timed */
+} BenchStage;
+
+static struct
+{
+    uint8_t masked[BENCH_ECC_LENGTH];
+    uint8_t eccData[BENCH_ECC_LENGTH];
+    uint8_t response[BENCH_RESPONSE_LENGTH];
+    uint8_t puf[BENCH_SEED_LENGTH];
+    uint8_t salt[BENCH_SEED_LENGTH];
+    mbedtls_pk_context key;
+    struct NetworkContext *tls;
+    uint32_t samples[BENCH_MAX_RUNS];
+} bench = {0};
+
+static ErrorCode Bench_RandomInputs(void)
+{
+    /* inputs do not need to be a real puf, only realistic in size */
+    if (Crypto_Random(NULL, bench.masked, sizeof(bench.masked)) || Crypto_Random(NULL, bench.eccData, sizeof(bench.eccData)) ||
+        Crypto_Random(NULL, bench.puf, sizeof(bench.puf)) || Crypto_Random(NULL, bench.salt, sizeof(bench.salt)))
+        return FAILURE;
+
+    return SUCCESS;
+}
+
+static ErrorCode Bench_RunPuf(void)
+{
+    Crypto_PufLock();
+    bool isOk = get_puf_response();
+    clean_puf_response();
+    Crypto_PufUnlock();
+
+    return isOk ? SUCCESS : FAILURE;
+}
+
+static ErrorCode Bench_RunCorrectData(void)
+{
+    correct_data(bench.masked, bench.eccData, sizeof(bench.eccData), bench.response, sizeof(bench.response));
+    return SUCCESS;
+}
+
+static ErrorCode Bench_RunEccKey(void)
+{
+    mbedtls_pk_context key;
+    mbedtls_pk_init(&key);
+
+    Buffer puf = {.buffer = bench.puf, .length = sizeof(bench.puf)};
+    Buffer salt = {.buffer = bench.salt, .length = sizeof(bench.salt)};
+    ErrorCode err = Crypto_GenerateECCKey(&key, puf, salt);
+
+    mbedtls_pk_free(&key);
+    return err;
+}
+
+static ErrorCode Bench_SetupCsr(void)
+{
+    ERROR_CHECK(Bench_RandomInputs());
+
+    mbedtls_pk_init(&bench.key);
+    Buffer puf = {.buffer = bench.puf, .length = sizeof(bench.puf)};
+    Buffer salt = {.buffer = bench.salt, .length = sizeof(bench.salt)};
+    return Crypto_GenerateECCKey(&bench.key, puf, salt);
+}
+
+static ErrorCode Bench_RunCsr(void)
+{
+    uint8_t csrBuf[BENCH_CSR_MAX_LEN];
+    Buffer csr = {.buffer = csrBuf, .length = sizeof(csrBuf)};
+    return Crypto_GenerateCSR(&bench.key, mkCSTRING("C=IT,CN=" DEVICE_ID ",O=" CERT_ORGANIZATION), &csr);
+}
+
+static void Bench_TeardownCsr(void)
+{
+    mbedtls_pk_free(&bench.key);
+}
+
+static ErrorCode Bench_SetupTls(void)
+{
+    /* a context of its own, the mqtt connection is not touched */
+    bench.tls = TLSTransport_Init(MQTT_ENDPOINT, MQTT_PORT, BENCH_TLS_TIMEOUT_MS, "NONE", "NONE", "NONE");
+    if (!bench.tls)
+        return FAILURE;
+
+    /* every run is a full handshake, kept out of the production stats and trace */
+    TLSTransport_DisableSessionCache(bench.tls);
+    return SUCCESS;
+}
+
+static ErrorCode Bench_RunTls(void)
+{
+    ErrorCode err = TLSTransport_Connect(bench.tls);
+    TLSTransport_Disconnect(bench.tls, true);
+    return err;
+}
+
+static void Bench_TeardownTls(void)
+{
+    TLSTransport_Free(bench.tls);
+    bench.tls = NULL;
+}
+
+static const BenchStage stages[] = {
+    {.name = "puf", .run = Bench_RunPuf},
+    {.name = "correct_data", .setup = Bench_RandomInputs, .run = Bench_RunCorrectData},
+    {.name = "ecc_key", .setup = Bench_RandomInputs, .run = Bench_RunEccKey},
+    {.name = "csr", .setup = Bench_SetupCsr, .run = Bench_RunCsr, .teardown = Bench_TeardownCsr},
+    {.name = "tls_handshake", .setup = Bench_SetupTls, .run = Bench_RunTls, .teardown = Bench_TeardownTls},
+};
+
+size_t Bench_GetStageCount(void)
+{
+    return ARRAY_SIZE(stages);
+}
+
+const char *Bench_GetStageName(size_t index)
+{
+    return index < ARRAY_SIZE(stages) ? stages[index].name : NULL;
+}
+
+static int Bench_CompareCycles(const void *a, const void *b)
+{
+    uint32_t left = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+    return (left > right) - (left < right);
+}
+
+ErrorCode Bench_RunStage(size_t index, uint32_t runs, BenchResult *outResult)
+{
+    if (index >= ARRAY_SIZE(stages) || runs == 0 || runs > BENCH_MAX_RUNS)
+        return FAILURE;
+
+    const BenchStage *stage = &stages[index];
+    memset(outResult, 0, sizeof(*outResult));
+    outResult->name = stage->name;
+
+    if (xTaskGetAffinity(NULL) == tskNO_AFFINITY)
+        ESP_LOGW(TAG, "task not pinned, cycle counts may mix cores");
+
+    int32_t heapBefore = (int32_t)esp_get_free_heap_size();
+
+    if (stage->setup && stage->setup())
+    {
+        ESP_LOGE(TAG, "%s: setup failed", stage->name);
+        return FAILURE;
+    }
+
+    /* failed runs are timed too, a timeout is worth seeing */
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        uint32_t start = esp_cpu_get_ccount();
+        ErrorCode err = stage->run();
+        bench.samples[i] = esp_cpu_get_ccount() - start;
+
+        if (err)
+            outResult->failures++;
+    }
+
+    if (stage->teardown)
+        stage->teardown();
+
+    outResult->heapDelta = (int32_t)esp_get_free_heap_size() - heapBefore;
+
+    qsort(bench.samples, runs, sizeof(bench.samples[0]), Bench_CompareCycles);
+    outResult->runs = runs;
+    outResult->minCycles = bench.samples[0];
+    outResult->medianCycles = bench.samples[runs / 2];
+    outResult->p99Cycles = bench.samples[(runs * 99 + 99) / 100 - 1];
+
+    return SUCCESS;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/error.h"
+
+/* samples kept per stage to compute the percentiles */
+#define BENCH_MAX_RUNS 100
+#define BENCH_DEFAULT_RUNS 10
+
+typedef struct BenchResult
+{
+    const char *name;
+    uint32_t runs;
+    uint32_t failures;
+    uint32_t minCycles;
+    uint32_t medianCycles;
+    uint32_t p99Cycles;
+    int32_t heapDelta; /* free heap after the runs minus before, negative on a leak */
+} BenchResult;
+
+/* stages are timed with the cycle counter of the calling core, call from a pinned task */
+size_t Bench_GetStageCount(void);
+const char *Bench_GetStageName(size_t index);
+ErrorCode Bench_RunStage(size_t index, uint32_t runs, BenchResult *outResult);
@@ -2,6 +2,9 @@
 
 #include "core/core.h"
 #include "crypto/crypto.h"
+#include "bench/bench.h"
+#include "core/trace.h"
+#include "telemetry/stats.h"
 #include "define.h"
 #include "puf_sec.h"
 
@@ -13,14 +16,19 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
+#include "esp_ota_ops.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include "lwip/netdb.h"
+#include "esp_vfs_eventfd.h"
+#include "freertos/queue.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "core/nvs.h"
 
@@ -28,24 +36,197 @@
 
 static const char *TAG = "TcpConsole";
 
+typedef enum ConsoleMode
+{
+    CONSOLE_MODE_TEXT,   /* interactive, one command per line with a prompt */
+    CONSOLE_MODE_BATCH,  /* "<tag> <command>" lines, answered by "+OK <tag>" or "-ERR <tag> ..." */
+    CONSOLE_MODE_BINARY, /* length-prefixed frames */
+} ConsoleMode;
+
+typedef enum ConsoleStatus
+{
+    CONSOLE_STATUS_OK,
+    CONSOLE_STATUS_FAILURE,
+    CONSOLE_STATUS_UNKNOWN,
+    CONSOLE_STATUS_EMPTY,
+} ConsoleStatus;
+
+typedef struct ConsoleClient
+{
+    int socket; /* -1 when the slot is free */
+    char address[16];
+    char line[LINE_BUFFER_SIZE]; /* bytes received, not yet a full request */
+    size_t lineLength;
+    size_t discardLength;           /* rest of an oversized request frame */
+    char command[LINE_BUFFER_SIZE]; /* request being executed */
+    uint16_t tag;                   /* tag of the request being executed */
+    ConsoleMode mode;
+    ConsoleMode nextMode; /* applied once the current request is answered */
+    atomic_bool isBusy;   /* an async command is running in the worker */
+    char output[CONSOLE_OUTPUT_BUFFER_SIZE]; /* written by the task owning the client */
+    size_t outputLength;
+    size_t frameStart; /* open data frame in binary mode */
+    bool isFrameOpen;
+} ConsoleClient;
+
+static struct
+{
+    bool isStarted;
+    int wakeFd; /* written by the worker when a command completes */
+    QueueHandle_t jobs;
+    ConsoleClient clients[CONSOLE_MAX_CLIENTS];
+} console = {0};
+
 static struct ConsoleCmd console_commands[] = {
     {.name = "help", .handler = Console_CmdHelp, .help = "show this help message"},
     {.name = "read", .handler = Console_CmdRead, .help = "read value from nvs"},
     {.name = "enroll", .handler = Console_CmdEnroll, .help = "entroll the SRAM PUF"},
-    {.name = "puf", .handler = Console_CmdPuf, .help = "print SRAM PUF buffer"},
+    {.name = "puf", .handler = Console_CmdPuf, .help = "print SRAM PUF buffer", .isAsync = true},
     {.name = "challenge", .handler = Console_CmdChallenge, .help = "trigger SRAM PUF with challenge"},
-    {.name = "refresh_cert", .handler = Console_CmdRefreshCrt, .help = "generate ECC key and print CSR"},
-    {.name = "store_cert", .handler = Console_CmdStoreCrt, .help = "store device certificate"},
+    {.name = "refresh_cert", .handler = Console_CmdRefreshCrt, .help = "generate ECC key and print CSR", .isAsync = true},
+    {.name = "store_cert", .handler = Console_CmdStoreCrt, .help = "store device certificate", .isAsync = true},
+    {.name = "bench", .handler = Console_CmdBench, .help = "time security stages: bench [stage|all] [runs]", .isAsync = true},
+    {.name = "mode", .handler = Console_CmdMode, .help = "switch framing: text, batch or binary"},
+    {.name = "trace", .handler = Console_CmdTrace, .help = "dump recorded spans: trace [clear]"},
+    {.name = "stats", .handler = Console_CmdStats, .help = "show runtime counters: stats [reset]"},
 };
 
+static ConsoleClient *Console_FindClient(int socket)
+{
+    for (size_t i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+    {
+        if (console.clients[i].socket == socket)
+            return &console.clients[i];
+    }
+
+    return NULL;
+}
+
+static void Console_Send(int socket, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        int sent = send(socket, data, length, 0);
+        if (sent <= 0)
+            return;
+
+        data += sent;
+        length -= sent;
+    }
+}
+
+static void Console_CloseFrame(ConsoleClient *client)
+{
+    if (!client->isFrameOpen)
+        return;
+
+    client->isFrameOpen = false;
+
+    size_t length = client->outputLength - client->frameStart - CONSOLE_FRAME_HEADER_SIZE;
+    if (length == 0)
+    {
+        client->outputLength = client->frameStart;
+        return;
+    }
+
+    client->output[client->frameStart + 3] = (char)(length >> 8);
+    client->output[client->frameStart + 4] = (char)length;
+}
+
+static void Console_SendOutput(ConsoleClient *client)
+{
+    Console_CloseFrame(client);
+    Console_Send(client->socket, client->output, client->outputLength);
+    client->outputLength = 0;
+}
+
+void Console_Flush(int socket)
+{
+    ConsoleClient *client = Console_FindClient(socket);
+    if (!client || client->outputLength == 0)
+        return;
+
+    Console_SendOutput(client);
+}
+
+static void Console_WriteFrame(ConsoleClient *client, char type, const char *data, size_t length)
+{
+    Console_CloseFrame(client);
+    if (sizeof(client->output) - client->outputLength < CONSOLE_FRAME_HEADER_SIZE + length)
+        Console_SendOutput(client);
+
+    char *header = client->output + client->outputLength;
+    header[0] = type;
+    header[1] = (char)(client->tag >> 8);
+    header[2] = (char)client->tag;
+    header[3] = (char)(length >> 8);
+    header[4] = (char)length;
+    client->outputLength += CONSOLE_FRAME_HEADER_SIZE;
+
+    /* data frames stay open and grow with the next writes */
+    client->frameStart = client->outputLength - CONSOLE_FRAME_HEADER_SIZE;
+    client->isFrameOpen = type == CONSOLE_FRAME_DATA;
+
+    memcpy(client->output + client->outputLength, data, length);
+    client->outputLength += length;
+}
+
+static void Console_Write(int socket, const char *data, size_t length)
+{
+    /* sockets without a session, like a rejected client, are written directly */
+    ConsoleClient *client = Console_FindClient(socket);
+    if (!client)
+    {
+        Console_Send(socket, data, length);
+        return;
+    }
+
+    bool isLineEnd = length > 0 && data[length - 1] == '\n';
+
+    while (length > 0)
+    {
+        if (sizeof(client->output) - client->outputLength <= CONSOLE_FRAME_HEADER_SIZE)
+            Console_SendOutput(client);
+
+        if (client->mode == CONSOLE_MODE_BINARY && !client->isFrameOpen)
+            Console_WriteFrame(client, CONSOLE_FRAME_DATA, NULL, 0);
+
+        size_t chunk = MIN(length, sizeof(client->output) - client->outputLength);
+        memcpy(client->output + client->outputLength, data, chunk);
+        client->outputLength += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+
+    if (isLineEnd && client->outputLength >= CONSOLE_OUTPUT_FLUSH_THRESHOLD)
+        Console_SendOutput(client);
+}
+
 static void Console_vprintf(int socket, const char *fmt, va_list args)
 {
-    char buffer[256] = {0};
+    char buffer[256];
+    va_list retry;
+    va_copy(retry, args);
+
     int length = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    if (length < (int)sizeof(buffer))
+    {
+        if (length > 0)
+            Console_Write(socket, buffer, length);
+        va_end(retry);
+        return;
+    }
 
-    // printf("=>> %s ", buffer);
+    /* rare long output, format it on the heap */
+    char *large = (char *)malloc(length + 1);
+    if (large)
+    {
+        vsnprintf(large, length + 1, fmt, retry);
+        Console_Write(socket, large, length);
+        free(large);
+    }
 
-    send(socket, buffer, length, 0);
+    va_end(retry);
 }
 
 void Console_Println(int socket, const char *fmt, ...)
@@ -53,7 +234,7 @@ void Console_Println(int socket, const char *fmt, ...)
     va_list args;
     va_start(args, fmt);
     Console_vprintf(socket, fmt, args);
-    send(socket, NEWLINE, sizeof(NEWLINE), 0);
+    Console_Write(socket, NEWLINE, strlen(NEWLINE));
     va_end(args);
 }
 
@@ -77,6 +258,34 @@ ErrorCode Console_CmdHelp(int socket, int argc, char *argv[])
     return SUCCESS;
 }
 
+static void Console_PrintBuffer(int socket, CBuffer buffer)
+{
+    char printBuf[250 + 1] = {0};
+    int remaining = buffer.length;
+    int i = 0;
+    while (remaining > 0)
+    {
+        int bytesToWrite = remaining > 250 ? 250 : remaining;
+        memcpy(printBuf, (buffer.buffer + i), bytesToWrite);
+        Console_Printf(socket, "%.*s", bytesToWrite, printBuf);
+        remaining = remaining - bytesToWrite;
+        i = i + bytesToWrite;
+    }
+}
+
+static void Console_PrintPem(int socket, CryptoPemType type, CBuffer der)
+{
+    Buffer pem;
+    if (Crypto_DerToPem(type, der, &pem))
+    {
+        Console_Println(socket, "ERROR invalid der");
+        return;
+    }
+
+    Console_PrintBuffer(socket, (CBuffer){.buffer = pem.buffer, .length = pem.length});
+    free(pem.buffer);
+}
+
 ErrorCode Console_CmdRead(int socket, int argc, char *argv[])
 {
     if (argc != 2)
@@ -93,17 +302,18 @@ ErrorCode Console_CmdRead(int socket, int argc, char *argv[])
         return FAILURE;
     }
 
-    char printBuf[250 + 1] = {0};
-    int remaining = buffer.length;
-    int i = 0;
-    while (remaining > 0)
-    {
-        int bytesToWrite = remaining > 250 ? 250 : remaining;
-        memcpy(printBuf, (buffer.buffer + i), bytesToWrite);
-        Console_Printf(socket, "%.*s", bytesToWrite, printBuf);
-        remaining = remaining - bytesToWrite;
-        i = i + bytesToWrite;
-    }
+    CBuffer data = {.buffer = buffer.buffer, .length = buffer.length};
+    const char *key = argv[1];
+
+    /* certificates and csr are stored as der, print them as pem */
+    if (Crypto_IsPem(data))
+        Console_PrintBuffer(socket, data);
+    else if (!strcmp(key, NVS_DEVICE_CERT_KEY) || !strcmp(key, NVS_DEVICE_CERT_KEY_TMP))
+        Console_PrintPem(socket, CRYPTO_PEM_CERTIFICATE, data);
+    else if (!strcmp(key, NVS_DEVICE_CSR_KEY) || !strcmp(key, NVS_DEVICE_CSR_KEY_TMP))
+        Console_PrintPem(socket, CRYPTO_PEM_CSR, data);
+    else
+        Console_PrintBuffer(socket, data);
 
     Console_Printf(socket, "\n");
     free(buffer.buffer);
@@ -119,6 +329,7 @@ ErrorCode Console_CmdEnroll(int socket, int argc, char *argv[])
 
 ErrorCode Console_CmdPuf(int socket, int argc, char *argv[])
 {
+    Crypto_PufLock();
     bool puf_ok = get_puf_response();
     if (PUF_STATE == RESPONSE_READY && puf_ok)
     {
@@ -134,6 +345,7 @@ ErrorCode Console_CmdPuf(int socket, int argc, char *argv[])
     }
 
     clean_puf_response();
+    Crypto_PufUnlock();
     return SUCCESS;
 }
 
@@ -154,23 +366,11 @@ ErrorCode Console_CmdChallenge(int socket, int argc, char *argv[])
 ErrorCode Console_CmdRefreshCrt(int socket, int argc, char *argv[])
 {
     /* create temporary cert */
-    Buffer csr;
+    Buffer csr = {0};
     ErrorCode err = Crypto_RefreshCertificate(&csr);
 
     if (!err)
-    {
-        char printBuf[250 + 1] = {0};
-        int remaining = csr.length;
-        int i = 0;
-        while (remaining > 0)
-        {
-            int bytesToWrite = remaining > 250 ? 250 : remaining;
-            memcpy(printBuf, (csr.buffer + i), bytesToWrite);
-            Console_Printf(socket, "%.*s", bytesToWrite, printBuf);
-            remaining = remaining - bytesToWrite;
-            i = i + bytesToWrite;
-        }
-    }
+        Console_PrintPem(socket, CRYPTO_PEM_CSR, (CBuffer){.buffer = csr.buffer, .length = csr.length});
 
     free(csr.buffer);
     return err;
@@ -187,8 +387,16 @@ ErrorCode Console_CmdStoreCrt(int socket, int argc, char *argv[])
     char certStr[500] = {0};
     size_t length = snprintf(certStr, sizeof(certStr), "-----BEGIN CERTIFICATE-----\n%s\n-----END CERTIFICATE-----", argv[1]);
 
-    Buffer cert = {.buffer = (uint8_t *)certStr, .length = length};
+    CBuffer certPem = {.buffer = (uint8_t *)certStr, .length = length};
+    Buffer cert;
+    if (Crypto_PemToDer(CRYPTO_PEM_CERTIFICATE, certPem, &cert))
+    {
+        Console_Println(socket, "invalid certificate");
+        return FAILURE;
+    }
+
     Nvs_SetBuffer(NVS_DEVICE_CERT_KEY_TMP, cert);
+    free(cert.buffer);
 
     Core_EventNotify(CORE_EVENT_CERT_ROTATION);
 
@@ -200,12 +408,160 @@ ErrorCode Console_CmdStoreCrt(int socket, int argc, char *argv[])
         return FAILURE;
     }
 
-    ESP_LOGI(TAG, "Stored certificate:\n%.*s", deviceCert.length, deviceCert.buffer);
+    ESP_LOGI(TAG, "Stored certificate (%u bytes der)", deviceCert.length);
     free(deviceCert.buffer);
     return SUCCESS;
 }
 
-void Console_RunCommand(const int socket, char *command)
+ErrorCode Console_CmdBench(int socket, int argc, char *argv[])
+{
+    const char *stage = argc > 1 ? argv[1] : "all";
+    int runs = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_RUNS;
+
+    if (argc > 3 || runs <= 0 || runs > BENCH_MAX_RUNS)
+    {
+        Console_Println(socket, "usage: %s [stage|all] [runs <= %d]", argv[0], BENCH_MAX_RUNS);
+        return FAILURE;
+    }
+
+    /* key=value lines, one per stage, so results can be diffed across builds */
+    Console_Println(socket, "bench version=%s runs=%d", esp_ota_get_app_description()->version, runs);
+
+    bool isFound = false;
+    ErrorCode err = SUCCESS;
+    for (size_t i = 0; i < Bench_GetStageCount(); i++)
+    {
+        if (strcmp(stage, "all") && strcmp(stage, Bench_GetStageName(i)))
+            continue;
+
+        isFound = true;
+
+        BenchResult result;
+        if (Bench_RunStage(i, runs, &result))
+        {
+            Console_Println(socket, "bench stage=%s error=setup", Bench_GetStageName(i));
+            err = FAILURE;
+            continue;
+        }
+
+        Console_Println(socket, "bench stage=%s runs=%u failures=%u min_cycles=%u median_cycles=%u p99_cycles=%u heap_delta=%d", result.name,
+                        result.runs, result.failures, result.minCycles, result.medianCycles, result.p99Cycles, result.heapDelta);
+        Console_Flush(socket);
+    }
+
+    if (!isFound)
+    {
+        Console_Println(socket, "unknown stage %s", stage);
+        return FAILURE;
+    }
+
+    return err;
+}
+
+static void Console_PrintSpan(const TraceRecord *record, void *ctx)
+{
+    int socket = *(int *)ctx;
+    Console_Println(socket, "span core=%u start_us=%u dur_us=%u name=%s", record->core, record->startUs, record->durationUs, record->name);
+}
+
+ErrorCode Console_CmdTrace(int socket, int argc, char *argv[])
+{
+    if (!Trace_IsEnabled())
+    {
+        Console_Println(socket, "tracing disabled");
+        return FAILURE;
+    }
+
+    if (argc == 2 && !strcmp(argv[1], "clear"))
+    {
+        Trace_Clear();
+        return SUCCESS;
+    }
+
+    if (argc != 1)
+    {
+        Console_Println(socket, "usage: %s [clear]", argv[0]);
+        return FAILURE;
+    }
+
+    /* parsed by scripts/trace_to_chrome.js */
+    Console_Println(socket, "trace version=%s now_us=%u", esp_ota_get_app_description()->version, Trace_NowUs());
+    uint32_t overwritten = Trace_ForEach(Console_PrintSpan, &socket);
+    Console_Println(socket, "trace overwritten=%u", overwritten);
+
+    return SUCCESS;
+}
+
+ErrorCode Console_CmdStats(int socket, int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "reset"))
+    {
+        Stats_Reset();
+        return SUCCESS;
+    }
+
+    if (argc != 1)
+    {
+        Console_Println(socket, "usage: %s [reset]", argv[0]);
+        return FAILURE;
+    }
+
+    /* the stack gauge is left to the core task, this runs on the console task */
+    Stats_SampleHeap();
+
+    /* key=value lines like the bench output */
+    for (size_t id = 0; id < STAT_COUNT; id++)
+    {
+        StatSnapshot snapshot;
+        Stats_Get(id, &snapshot);
+
+        switch (snapshot.type)
+        {
+        case STAT_TYPE_COUNTER:
+            Console_Println(socket, "counter name=%s value=%u", snapshot.name, snapshot.counter);
+            break;
+        case STAT_TYPE_GAUGE:
+            Console_Println(socket, "gauge name=%s value=%d", snapshot.name, snapshot.gauge);
+            break;
+        case STAT_TYPE_HISTOGRAM:
+            Console_Println(socket, "histogram name=%s count=%u sum=%u max=%u p50=%u p99=%u", snapshot.name, snapshot.histogram.count,
+                            snapshot.histogram.sum, snapshot.histogram.max, snapshot.histogram.p50, snapshot.histogram.p99);
+            break;
+        }
+    }
+
+    return SUCCESS;
+}
+
+ErrorCode Console_CmdMode(int socket, int argc, char *argv[])
+{
+    static const char *modes[] = {"text", "batch", "binary"};
+
+    ConsoleClient *client = Console_FindClient(socket);
+    if (!client)
+        return FAILURE;
+
+    if (argc == 1)
+    {
+        Console_Println(socket, "%s", modes[client->mode]);
+        return SUCCESS;
+    }
+
+    for (size_t i = 0; argc == 2 && i < ARRAY_SIZE(modes); i++)
+    {
+        if (!strcmp(argv[1], modes[i]))
+        {
+            /* this answer still uses the current framing */
+            client->nextMode = (ConsoleMode)i;
+            return SUCCESS;
+        }
+    }
+
+    Console_Println(socket, "usage: %s [text|batch|binary]", argv[0]);
+    return FAILURE;
+}
+
+static ConsoleStatus Console_Invoke(const int socket, char *command, const char **outName)
 {
     int argc = 0;
     char *ptr = NULL;
@@ -215,8 +571,9 @@ void Console_RunCommand(const int socket, char *command)
         ;
     argc--;
 
+    *outName = argv[0];
     if (!argv[0])
-        return;
+        return CONSOLE_STATUS_EMPTY;
 
     for (size_t i = 0; i < ARRAY_SIZE(console_commands); i++)
     {
@@ -224,48 +581,388 @@ void Console_RunCommand(const int socket, char *command)
         {
             ESP_LOGI(TAG, "received command: %s", command);
             ErrorCode error = console_commands[i].handler(socket, argc, argv);
-            if (error)
-                Console_Println(socket, "-ERR: Failure");
-            else
-                Console_Println(socket, "+OK");
+            return error ? CONSOLE_STATUS_FAILURE : CONSOLE_STATUS_OK;
+        }
+    }
+
+    return CONSOLE_STATUS_UNKNOWN;
+}
+
+static void Console_PrintStatus(const int socket, ConsoleStatus status, const char *name)
+{
+    char message[64];
+    switch (status)
+    {
+    case CONSOLE_STATUS_OK:
+        message[0] = '\0';
+        break;
+    case CONSOLE_STATUS_FAILURE:
+        snprintf(message, sizeof(message), "Failure");
+        break;
+    case CONSOLE_STATUS_UNKNOWN:
+        snprintf(message, sizeof(message), "Unknown command %s", name);
+        break;
+    default:
+        snprintf(message, sizeof(message), "Empty command");
+        break;
+    }
+
+    ConsoleClient *client = Console_FindClient(socket);
+    ConsoleMode mode = client ? client->mode : CONSOLE_MODE_TEXT;
+
+    switch (mode)
+    {
+    case CONSOLE_MODE_BINARY:
+        Console_WriteFrame(client, status == CONSOLE_STATUS_OK ? CONSOLE_FRAME_OK : CONSOLE_FRAME_ERROR, message, strlen(message));
+        break;
+    case CONSOLE_MODE_BATCH:
+        if (status == CONSOLE_STATUS_OK)
+            Console_Println(socket, "+OK %u", client->tag);
+        else
+            Console_Println(socket, "-ERR %u %s", client->tag, message);
+        break;
+    default:
+        /* an empty line only gets a new prompt */
+        if (status == CONSOLE_STATUS_OK)
+            Console_Println(socket, "+OK");
+        else if (status != CONSOLE_STATUS_EMPTY)
+            Console_Println(socket, "-ERR: %s", message);
+        break;
+    }
+}
+
+void Console_RunCommand(const int socket, char *command)
+{
+    const char *name;
+    ConsoleStatus status = Console_Invoke(socket, command, &name);
+    Console_PrintStatus(socket, status, name);
+}
+
+static const struct ConsoleCmd *Console_FindCommand(const char *line)
+{
+    /* first word of the line, not tokenized yet */
+    line += strspn(line, " \t");
+    size_t length = strcspn(line, " \t");
+
+    for (size_t i = 0; i < ARRAY_SIZE(console_commands); i++)
+    {
+        if (strlen(console_commands[i].name) == length && !strncmp(console_commands[i].name, line, length))
+            return &console_commands[i];
+    }
+
+    return NULL;
+}
+
+static void Console_Wake(void)
+{
+    uint64_t posted = 1;
+    write(console.wakeFd, &posted, sizeof(posted));
+}
+
+static void Console_FinishRequest(ConsoleClient *client)
+{
+    /* a mode command switches after its own answer */
+    if (client->nextMode != client->mode)
+    {
+        Console_CloseFrame(client);
+        client->mode = client->nextMode;
+    }
+
+    if (client->mode == CONSOLE_MODE_TEXT)
+        Console_Printf(client->socket, PROMPT);
+}
 
+static void Console_TaskWorker(void *pvParameters)
+{
+    ConsoleClient *client;
+
+    while (true)
+    {
+        if (xQueueReceive(console.jobs, &client, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        Console_RunCommand(client->socket, client->command);
+        Console_FinishRequest(client);
+        Console_Flush(client->socket);
+
+        /* hand the client back to the server task */
+        atomic_store(&client->isBusy, false);
+        Console_Wake();
+    }
+}
+
+static void Console_ExecuteRequest(ConsoleClient *client, uint16_t tag, const char *request, size_t length)
+{
+    length = MIN(length, sizeof(client->command) - 1);
+    memcpy(client->command, request, length);
+    client->command[length] = '\0';
+    client->tag = tag;
+
+    /* long-running commands must not stall the other clients */
+    const struct ConsoleCmd *command = Console_FindCommand(client->command);
+    if (command && command->isAsync)
+    {
+        atomic_store(&client->isBusy, true);
+        if (xQueueSend(console.jobs, &client, 0) == pdTRUE)
             return;
-        }
+
+        atomic_store(&client->isBusy, false);
+        Console_PrintStatus(client->socket, CONSOLE_STATUS_FAILURE, command->name);
+    }
+    else
+    {
+        Console_RunCommand(client->socket, client->command);
     }
 
-    Console_Println(socket, "-ERR: Unknown command %s", argv[0]);
+    Console_FinishRequest(client);
 }
 
-static void Console_GetCommand(const int socket)
+static void Console_ExecuteBatchLine(ConsoleClient *client, char *line)
 {
-    int length;
-    char cmd[500];
+    /* blank lines keep a pipelined script readable */
+    line += strspn(line, " \t");
+    if (*line == '\0')
+        return;
 
-    do
+    char *end;
+    unsigned long tag = strtoul(line, &end, 10);
+    if (end == line || tag > UINT16_MAX || (*end != ' ' && *end != '\t' && *end != '\0'))
     {
-        Console_Printf(socket, PROMPT);
-        length = recv(socket, cmd, sizeof(cmd) - 1, 0);
-        if (length > 0)
+        client->tag = 0;
+        Console_Println(client->socket, "-ERR 0 Invalid tag");
+        return;
+    }
+
+    Console_ExecuteRequest(client, (uint16_t)tag, end, strlen(end));
+}
+
+static bool Console_ProcessFrame(ConsoleClient *client)
+{
+    if (client->lineLength < CONSOLE_REQUEST_HEADER_SIZE)
+        return false;
+
+    const uint8_t *header = (const uint8_t *)client->line;
+    uint16_t tag = (header[0] << 8) | header[1];
+    size_t length = (header[2] << 8) | header[3];
+
+    /* a frame must fit in the receive buffer */
+    if (CONSOLE_REQUEST_HEADER_SIZE + length > sizeof(client->line))
+    {
+        ESP_LOGE(TAG, "request frame of %u bytes from %s too long", length, client->address);
+        client->tag = tag;
+        Console_PrintStatus(client->socket, CONSOLE_STATUS_FAILURE, NULL);
+        client->discardLength = CONSOLE_REQUEST_HEADER_SIZE + length - client->lineLength;
+        client->lineLength = 0;
+        return false;
+    }
+
+    if (client->lineLength < CONSOLE_REQUEST_HEADER_SIZE + length)
+        return false;
+
+    Console_ExecuteRequest(client, tag, client->line + CONSOLE_REQUEST_HEADER_SIZE, length);
+
+    size_t consumed = CONSOLE_REQUEST_HEADER_SIZE + length;
+    client->lineLength -= consumed;
+    memmove(client->line, client->line + consumed, client->lineLength);
+    return true;
+}
+
+static bool Console_ProcessLine(ConsoleClient *client)
+{
+    char *end = memchr(client->line, '\n', client->lineLength);
+    if (!end)
+        return false;
+
+    *end = '\0';
+    if (end > client->line && end[-1] == '\r')
+        end[-1] = '\0';
+
+    if (client->mode == CONSOLE_MODE_BATCH)
+        Console_ExecuteBatchLine(client, client->line);
+    else
+        Console_ExecuteRequest(client, 0, client->line, strlen(client->line));
+
+    size_t consumed = end - client->line + 1;
+    client->lineLength -= consumed;
+    memmove(client->line, end + 1, client->lineLength);
+    return true;
+}
+
+static void Console_ProcessRequests(ConsoleClient *client)
+{
+    /* execute complete requests, the rest waits for more data or the running command.
+     * the mode is checked on each request, a mode command changes the framing of the next one */
+    while (!atomic_load(&client->isBusy))
+    {
+        bool isExecuted = client->mode == CONSOLE_MODE_BINARY ? Console_ProcessFrame(client) : Console_ProcessLine(client);
+        if (!isExecuted)
+            return;
+    }
+}
+
+static void Console_CloseClient(ConsoleClient *client)
+{
+    ESP_LOGI(TAG, "client disconnected: %s", client->address);
+
+    shutdown(client->socket, 0);
+    close(client->socket);
+    client->socket = -1;
+}
+
+static void Console_ReadClient(ConsoleClient *client)
+{
+    /* a line longer than the buffer is dropped */
+    if (client->lineLength == sizeof(client->line))
+    {
+        Console_Println(client->socket, "-ERR: Line too long");
+        client->lineLength = 0;
+    }
+
+    int length = recv(client->socket, client->line + client->lineLength, sizeof(client->line) - client->lineLength, 0);
+    if (length <= 0)
+    {
+        Console_CloseClient(client);
+        return;
+    }
+
+    client->lineLength += length;
+
+    /* skip what is left of a rejected frame */
+    size_t discarded = MIN(client->discardLength, client->lineLength);
+    client->discardLength -= discarded;
+    client->lineLength -= discarded;
+    memmove(client->line, client->line + discarded, client->lineLength);
+
+    Console_ProcessRequests(client);
+
+    /* output of the commands in this segment leaves together */
+    if (!atomic_load(&client->isBusy))
+        Console_Flush(client->socket);
+}
+
+static void Console_AcceptClient(int serverSocket)
+{
+    int keepAlive = 1;
+    int keepIdle = CONSOLE_KEEPALIVE_IDLE;
+    int keepInterval = CONSOLE_KEEPALIVE_INTERVAL;
+    int keepCount = CONSOLE_KEEPALIVE_COUNT;
+
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+    int client_socket = accept(serverSocket, (struct sockaddr *)&client_addr, &client_addr_len);
+    if (client_socket < 0)
+    {
+        ESP_LOGE(TAG, "unable to accept connection: errno %d", errno);
+        return;
+    }
+
+    ConsoleClient *client = NULL;
+    for (size_t i = 0; i < CONSOLE_MAX_CLIENTS && !client; i++)
+    {
+        if (console.clients[i].socket < 0)
+            client = &console.clients[i];
+    }
+
+    if (!client)
+    {
+        ESP_LOGW(TAG, "rejected client, %d already connected", CONSOLE_MAX_CLIENTS);
+        Console_Println(client_socket, "-ERR: Too many clients");
+        close(client_socket);
+        return;
+    }
+
+    /* set tcp keepalive option */
+    setsockopt(client_socket, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
+    setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
+    setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
+    setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+
+    client->socket = client_socket;
+    client->lineLength = 0;
+    client->discardLength = 0;
+    client->outputLength = 0;
+    client->isFrameOpen = false;
+    client->mode = CONSOLE_MODE_TEXT;
+    client->nextMode = CONSOLE_MODE_TEXT;
+    client->tag = 0;
+    client->address[0] = '\0';
+    atomic_store(&client->isBusy, false);
+
+    /* convert ip address to string */
+    if (client_addr.sin_family == PF_INET)
+        inet_ntoa_r(client_addr.sin_addr, client->address, sizeof(client->address) - 1);
+
+    ESP_LOGI(TAG, "client connected to remote console: %s", client->address);
+    Console_Printf(client->socket, PROMPT);
+    Console_Flush(client->socket);
+}
+
+static void Console_Serve(int serverSocket)
+{
+    while (true)
+    {
+        fd_set readFds;
+        FD_ZERO(&readFds);
+        FD_SET(serverSocket, &readFds);
+        FD_SET(console.wakeFd, &readFds);
+        int maxFd = MAX(serverSocket, console.wakeFd);
+
+        /* busy clients are not read, their input waits in the socket */
+        for (size_t i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+        {
+            ConsoleClient *client = &console.clients[i];
+            if (client->socket >= 0 && !atomic_load(&client->isBusy))
+            {
+                FD_SET(client->socket, &readFds);
+                maxFd = MAX(maxFd, client->socket);
+            }
+        }
+
+        if (select(maxFd + 1, &readFds, NULL, NULL, NULL) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            ESP_LOGE(TAG, "select failed: errno %d", errno);
+            return;
+        }
+
+        /* an async command completed, run the lines queued behind it */
+        if (FD_ISSET(console.wakeFd, &readFds))
         {
-            cmd[length - 1] = '\0';
-            Console_RunCommand(socket, cmd);
+            uint64_t posted;
+            read(console.wakeFd, &posted, sizeof(posted));
+
+            for (size_t i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+            {
+                ConsoleClient *client = &console.clients[i];
+                if (client->socket < 0 || atomic_load(&client->isBusy))
+                    continue;
+
+                Console_ProcessRequests(client);
+                if (!atomic_load(&client->isBusy))
+                    Console_Flush(client->socket);
+            }
+        }
+
+        for (size_t i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+        {
+            ConsoleClient *client = &console.clients[i];
+            if (client->socket >= 0 && FD_ISSET(client->socket, &readFds))
+                Console_ReadClient(client);
         }
-    } while (length > 0);
 
-    ESP_LOGI(TAG, "client disconnected");
+        if (FD_ISSET(serverSocket, &readFds))
+            Console_AcceptClient(serverSocket);
+    }
 }
 
 void Console_TaskTcpConsole(void *pvParameters)
 {
     ESP_LOGI(TAG, "open socket...");
 
-    char client_addr_str[128];
     int addr_family = AF_INET;
     int ip_protocol = IPPROTO_IP;
-    int keepAlive = 1;
-    int keepIdle = CONSOLE_KEEPALIVE_IDLE;
-    int keepInterval = CONSOLE_KEEPALIVE_INTERVAL;
-    int keepCount = CONSOLE_KEEPALIVE_COUNT;
 
     int server_socket = socket(addr_family, SOCK_STREAM, ip_protocol);
     if (server_socket < 0)
@@ -293,45 +990,15 @@ void Console_TaskTcpConsole(void *pvParameters)
 
     ESP_LOGI(TAG, "socket bound, port %d", CONSOLE_PORT);
 
-    int listen_err = listen(server_socket, 1);
+    int listen_err = listen(server_socket, CONSOLE_MAX_CLIENTS);
     if (listen_err != 0)
     {
         ESP_LOGE(TAG, "error occurred during listen: errno %d", errno);
         goto failure;
     }
 
-    while (true)
-    {
-        ESP_LOGI(TAG, "remote console listening");
-
-        struct sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
-        int client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_addr_len);
-        if (client_socket < 0)
-        {
-            ESP_LOGE(TAG, "unable to accept connection: errno %d", errno);
-            break;
-        }
-
-        /* set tcp keepalive option */
-        setsockopt(client_socket, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
-        setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
-        setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
-        setsockopt(client_socket, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
-
-        /* convert ip address to string */
-        if (client_addr.sin_family == PF_INET)
-        {
-            inet_ntoa_r(((struct sockaddr_in *)&client_addr)->sin_addr, client_addr_str, sizeof(client_addr_str) - 1);
-        }
-
-        ESP_LOGI(TAG, "client connected to remote console: %s", client_addr_str);
-
-        Console_GetCommand(client_socket);
-
-        shutdown(client_socket, 0);
-        close(client_socket);
-    }
+    ESP_LOGI(TAG, "remote console listening (%d clients)", CONSOLE_MAX_CLIENTS);
+    Console_Serve(server_socket);
 
 failure:
     close(server_socket);
@@ -340,5 +1007,23 @@ failure:
 
 void Console_TaskStart(void)
 {
-    xTaskCreate(Console_TaskTcpConsole, "tcp_console_task", 10000, NULL, uxTaskPriorityGet(NULL) + 1, NULL);
+    /* the listening socket survives a wifi reconnection */
+    if (console.isStarted)
+        return;
+
+    for (size_t i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+        console.clients[i].socket = -1;
+
+    /* each client has at most one command in the worker */
+    console.jobs = xQueueCreate(CONSOLE_MAX_CLIENTS, sizeof(ConsoleClient *));
+    console.wakeFd = eventfd(0, 0);
+    if (!console.jobs || console.wakeFd < 0)
+    {
+        ESP_LOGE(TAG, "failed to create console worker queue");
+        return;
+    }
+
+    console.isStarted = true;
+    xTaskCreatePinnedToCore(Console_TaskWorker, "tcp_console_worker", CONSOLE_WORKER_STACK_SIZE, NULL, uxTaskPriorityGet(NULL), NULL, CONSOLE_WORKER_CORE);
+    xTaskCreate(Console_TaskTcpConsole, "tcp_console_task", CONSOLE_TASK_STACK_SIZE, NULL, uxTaskPriorityGet(NULL) + 1, NULL);
 }
\ No newline at end of file
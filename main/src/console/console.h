@@ -2,14 +2,35 @@
 
 #include "core/error.h"
 
+#include <stdbool.h>
+
 #define CONSOLE_PORT CONFIG_CONSOLE_PORT
 #define CONSOLE_KEEPALIVE_IDLE CONFIG_CONSOLE_KEEPALIVE_IDLE
 #define CONSOLE_KEEPALIVE_INTERVAL CONFIG_CONSOLE_KEEPALIVE_INTERVAL
 #define CONSOLE_KEEPALIVE_COUNT CONFIG_CONSOLE_KEEPALIVE_COUNT
+#define CONSOLE_MAX_CLIENTS CONFIG_CONSOLE_MAX_CLIENTS
+
+#define CONSOLE_TASK_STACK_SIZE 10000
+#define CONSOLE_WORKER_STACK_SIZE 10000
+/* the worker is pinned, bench reads the cycle counter of its core */
+#define CONSOLE_WORKER_CORE (portNUM_PROCESSORS - 1)
 
 #define PROMPT ">> "
 #define LINE_BUFFER_SIZE 512
 
+/* output of a client is coalesced, a full buffer is about one tcp segment */
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1400
+/* a line ending past this fill level is flushed right away */
+#define CONSOLE_OUTPUT_FLUSH_THRESHOLD 1024
+
+/* binary mode, requests are [tag:2][length:2][command] and responses [type:1][tag:2][length:2][data],
+ * all big endian. output of a command comes in data frames followed by one status frame */
+#define CONSOLE_REQUEST_HEADER_SIZE 4
+#define CONSOLE_FRAME_HEADER_SIZE 5
+#define CONSOLE_FRAME_DATA 'D'
+#define CONSOLE_FRAME_OK 'O'
+#define CONSOLE_FRAME_ERROR 'E'
+
 typedef ErrorCode (*ConsoleCommandHandler)(int socket, int argc, char *argv[]);
 
 struct ConsoleCmd
@@ -17,6 +38,7 @@ struct ConsoleCmd
     const char *name;
     const char *help;
     ConsoleCommandHandler handler;
+    bool isAsync; /* long-running, executed by the worker task */
 };
 
 /* console commands */
@@ -28,9 +50,14 @@ ErrorCode Console_CmdPuf(int socket, int argc, char *argv[]);
 ErrorCode Console_CmdChallenge(int socket, int argc, char *argv[]);
 ErrorCode Console_CmdRefreshCrt(int socket, int argc, char *argv[]);
 ErrorCode Console_CmdStoreCrt(int socket, int argc, char *argv[]);
+ErrorCode Console_CmdBench(int socket, int argc, char *argv[]);
+ErrorCode Console_CmdMode(int socket, int argc, char *argv[]);
+ErrorCode Console_CmdTrace(int socket, int argc, char *argv[]);
+ErrorCode Console_CmdStats(int socket, int argc, char *argv[]);
 
 void Console_Printf(int socket, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 void Console_Println(int socket, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void Console_Flush(int socket);
 
 void Console_RunCommand(int socket, char *command);
 
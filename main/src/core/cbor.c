@@ -0,0 +1,231 @@
+#include "core/cbor.h"
+
+#include <string.h>
+
+#define CBOR_MAJOR_SHIFT 5
+#define CBOR_INFO_MASK 0x1F
+
+#define CBOR_INFO_UINT8 24
+#define CBOR_INFO_UINT16 25
+#define CBOR_INFO_UINT32 26
+#define CBOR_INFO_UINT64 27
+
+#define CBOR_SIMPLE_FLOAT32 0xFA
+
+/* bound recursion while skipping nested items */
+#define CBOR_MAX_DEPTH 8
+
+static void Cbor_Put(CborWriter *writer, const uint8_t *data, size_t length)
+{
+    if (writer->overflow || writer->size - writer->length < length)
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+static void Cbor_WriteHead(CborWriter *writer, CborType major, uint64_t value)
+{
+    uint8_t head[9];
+    size_t length;
+
+    /* shortest encoding of the argument */
+    if (value < CBOR_INFO_UINT8)
+    {
+        head[0] = value;
+        length = 1;
+    }
+    else if (value <= UINT8_MAX)
+    {
+        head[0] = CBOR_INFO_UINT8;
+        length = 2;
+    }
+    else if (value <= UINT16_MAX)
+    {
+        head[0] = CBOR_INFO_UINT16;
+        length = 3;
+    }
+    else if (value <= UINT32_MAX)
+    {
+        head[0] = CBOR_INFO_UINT32;
+        length = 5;
+    }
+    else
+    {
+        head[0] = CBOR_INFO_UINT64;
+        length = 9;
+    }
+
+    head[0] |= major << CBOR_MAJOR_SHIFT;
+    for (size_t i = 1; i < length; i++)
+        head[i] = value >> (8 * (length - 1 - i));
+
+    Cbor_Put(writer, head, length);
+}
+
+void Cbor_WriterInit(CborWriter *writer, uint8_t *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->overflow = false;
+}
+
+void Cbor_WriteUint(CborWriter *writer, uint64_t value)
+{
+    Cbor_WriteHead(writer, CBOR_TYPE_UINT, value);
+}
+
+void Cbor_WriteInt(CborWriter *writer, int64_t value)
+{
+    if (value < 0)
+        Cbor_WriteHead(writer, CBOR_TYPE_NEGINT, (uint64_t)(-1 - value));
+    else
+        Cbor_WriteHead(writer, CBOR_TYPE_UINT, (uint64_t)value);
+}
+
+void Cbor_WriteBytes(CborWriter *writer, const uint8_t *data, size_t length)
+{
+    Cbor_WriteHead(writer, CBOR_TYPE_BYTES, length);
+    Cbor_Put(writer, data, length);
+}
+
+void Cbor_WriteText(CborWriter *writer, const char *text, size_t length)
+{
+    Cbor_WriteHead(writer, CBOR_TYPE_TEXT, length);
+    Cbor_Put(writer, (const uint8_t *)text, length);
+}
+
+void Cbor_WriteArray(CborWriter *writer, size_t count)
+{
+    Cbor_WriteHead(writer, CBOR_TYPE_ARRAY, count);
+}
+
+void Cbor_WriteMap(CborWriter *writer, size_t count)
+{
+    Cbor_WriteHead(writer, CBOR_TYPE_MAP, count);
+}
+
+void Cbor_WriteFloat(CborWriter *writer, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint8_t encoded[5] = {CBOR_SIMPLE_FLOAT32, bits >> 24, bits >> 16, bits >> 8, bits};
+    Cbor_Put(writer, encoded, sizeof(encoded));
+}
+
+ErrorCode Cbor_WriterFinish(CborWriter *writer, CBuffer *outData)
+{
+    if (writer->overflow)
+        return FAILURE;
+
+    outData->buffer = writer->buffer;
+    outData->length = writer->length;
+    return SUCCESS;
+}
+
+void Cbor_ReaderInit(CborReader *reader, CBuffer data)
+{
+    reader->buffer = data.buffer;
+    reader->length = data.length;
+    reader->offset = 0;
+}
+
+ErrorCode Cbor_ReadItem(CborReader *reader, CborItem *outItem)
+{
+    if (reader->offset >= reader->length)
+        return FAILURE;
+
+    uint8_t initial = reader->buffer[reader->offset++];
+    uint8_t info = initial & CBOR_INFO_MASK;
+    size_t argLength = 0;
+
+    outItem->type = (CborType)(initial >> CBOR_MAJOR_SHIFT);
+    outItem->data = NULL;
+
+    if (info < CBOR_INFO_UINT8)
+        outItem->value = info;
+    else if (info <= CBOR_INFO_UINT64)
+        argLength = 1 << (info - CBOR_INFO_UINT8);
+    else
+        return FAILURE; /* reserved or indefinite length */
+
+    if (reader->length - reader->offset < argLength)
+        return FAILURE;
+
+    if (argLength > 0)
+    {
+        outItem->value = 0;
+        for (size_t i = 0; i < argLength; i++)
+            outItem->value = (outItem->value << 8) | reader->buffer[reader->offset++];
+    }
+
+    if (outItem->type == CBOR_TYPE_BYTES || outItem->type == CBOR_TYPE_TEXT)
+    {
+        if (reader->length - reader->offset < outItem->value)
+            return FAILURE;
+
+        outItem->data = &reader->buffer[reader->offset];
+        reader->offset += outItem->value;
+    }
+
+    return SUCCESS;
+}
+
+static ErrorCode Cbor_SkipItemDepth(CborReader *reader, size_t depth)
+{
+    CborItem item;
+    if (depth > CBOR_MAX_DEPTH || Cbor_ReadItem(reader, &item))
+        return FAILURE;
+
+    uint64_t children = 0;
+    if (item.type == CBOR_TYPE_ARRAY)
+        children = item.value;
+    else if (item.type == CBOR_TYPE_MAP)
+        children = item.value * 2;
+    else if (item.type == CBOR_TYPE_TAG)
+        children = 1;
+
+    for (uint64_t i = 0; i < children; i++)
+        ERROR_CHECK(Cbor_SkipItemDepth(reader, depth + 1));
+
+    return SUCCESS;
+}
+
+ErrorCode Cbor_SkipItem(CborReader *reader)
+{
+    return Cbor_SkipItemDepth(reader, 0);
+}
+
+ErrorCode Cbor_MapFind(CBuffer map, const char *key, CborItem *outItem)
+{
+    CborReader reader;
+    CborItem item;
+    size_t keyLength = strlen(key);
+
+    Cbor_ReaderInit(&reader, map);
+    if (Cbor_ReadItem(&reader, &item) || item.type != CBOR_TYPE_MAP)
+        return FAILURE;
+
+    for (uint64_t i = 0; i < item.value; i++)
+    {
+        CborItem entryKey;
+        ERROR_CHECK(Cbor_ReadItem(&reader, &entryKey));
+
+        /* only scalar keys are supported */
+        if (entryKey.type == CBOR_TYPE_ARRAY || entryKey.type == CBOR_TYPE_MAP || entryKey.type == CBOR_TYPE_TAG)
+            return FAILURE;
+
+        bool isMatch = entryKey.type == CBOR_TYPE_TEXT && entryKey.value == keyLength && memcmp(entryKey.data, key, keyLength) == 0;
+        if (isMatch)
+            return Cbor_ReadItem(&reader, outItem);
+
+        ERROR_CHECK(Cbor_SkipItem(&reader));
+    }
+
+    return FAILURE;
+}
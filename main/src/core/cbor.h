@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/error.h"
+#include "define.h"
+
+/* CBOR (RFC 8949) with definite lengths only, no allocation */
+
+typedef enum CborType
+{
+    CBOR_TYPE_UINT,
+    CBOR_TYPE_NEGINT,
+    CBOR_TYPE_BYTES,
+    CBOR_TYPE_TEXT,
+    CBOR_TYPE_ARRAY,
+    CBOR_TYPE_MAP,
+    CBOR_TYPE_TAG,
+    CBOR_TYPE_SIMPLE,
+} CborType;
+
+/* writes into a caller buffer, overflow is sticky and checked once at the end */
+typedef struct CborWriter
+{
+    uint8_t *buffer;
+    size_t size;
+    size_t length;
+    bool overflow;
+} CborWriter;
+
+typedef struct CborReader
+{
+    const uint8_t *buffer;
+    size_t length;
+    size_t offset;
+} CborReader;
+
+/* bytes and text point into the reader buffer */
+typedef struct CborItem
+{
+    CborType type;
+    uint64_t value;
+    const uint8_t *data;
+} CborItem;
+
+void Cbor_WriterInit(CborWriter *writer, uint8_t *buffer, size_t size);
+void Cbor_WriteUint(CborWriter *writer, uint64_t value);
+void Cbor_WriteInt(CborWriter *writer, int64_t value);
+void Cbor_WriteBytes(CborWriter *writer, const uint8_t *data, size_t length);
+void Cbor_WriteText(CborWriter *writer, const char *text, size_t length);
+void Cbor_WriteArray(CborWriter *writer, size_t count);
+void Cbor_WriteMap(CborWriter *writer, size_t count);
+void Cbor_WriteFloat(CborWriter *writer, float value);
+ErrorCode Cbor_WriterFinish(CborWriter *writer, CBuffer *outData);
+
+void Cbor_ReaderInit(CborReader *reader, CBuffer data);
+ErrorCode Cbor_ReadItem(CborReader *reader, CborItem *outItem);
+ErrorCode Cbor_SkipItem(CborReader *reader);
+ErrorCode Cbor_MapFind(CBuffer map, const char *key, CborItem *outItem);
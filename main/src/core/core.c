@@ -3,12 +3,18 @@
 #include "net/http_client.h"
 #include "console/console.h"
 #include "net/http_client.h"
-#include "net/mqtt.h"
+#include "net/net_task.h"
+#include "net/topic_router.h"
 #include "define.h"
 #include "puf_sec.h"
 #include "core/nvs.h"
 #include "core/error.h"
 #include "crypto/crypto.h"
+#include "telemetry/telemetry.h"
+#include "telemetry/stats.h"
+#include "core/cbor.h"
+#include "core/json_arena.h"
+#include "core/trace.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -17,17 +23,36 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
 #include "cJSON.h"
 
+#include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/select.h>
 
 #define CORE_TASK_QUEUE_SIZE 10
-#define CORE_TASK_PERIOD_MS 500
 
-#define STATE_UPDATE_INTERVAL 5000
+/* longest sleep of the core task when nothing is scheduled */
+#define CORE_TASK_IDLE_WAIT_MS 60000
 
-#define CLOUD_RECONNECTION_INTERVAL 60000
+/* connection attempts with a new certificate before it is rejected */
+#define CORE_ROTATION_MAX_ATTEMPTS 3
+
+#define CORE_EVENT_MAX_DATA_SIZE 64
+
+/* encoding of outgoing management and telemetry messages, incoming ones are selected by topic */
+#ifdef CONFIG_MQTT_CBOR_ENCODING
+#define CORE_USE_CBOR true
+#else
+#define CORE_USE_CBOR false
+#endif
+
+#define CORE_CBOR_CSR_MAX_SIZE 1024
 
 static const char *TAG = "Core";
 
@@ -39,27 +64,46 @@ ESP_EVENT_DEFINE_BASE(CORE_EVENT);
 static struct
 {
     CoreState state;
-    uint32_t lastStatePutTimestamp;
-    uint32_t lastCloudConnectionTimestamp;
+    uint32_t lastTelemetryTimestamp;
+    uint32_t lastMetricsTimestamp;
     bool isCertificateRotationEnabled;
+    uint8_t rotationAttempts;
+    int wakeFd;
+    TaskHandle_t taskHandle;
+    TraceSpan wifiSpan;
 } coreState = {0};
 
+/* events carry their post time to measure dispatch latency */
+typedef struct CoreEventEnvelope
+{
+    int64_t postedUs;
+    uint8_t data[CORE_EVENT_MAX_DATA_SIZE];
+} CoreEventEnvelope;
+
 void Core_SetCoreState(CoreState newState);
 static void Core_TaskMain(void *pvParameters);
 static void Core_EnrollPuf(void);
-static void Core_CloudConnect();
 static void Core_CloudProcessLoop(uint32_t timestamp);
-static void Core_CloudCallback(CString topic, CBuffer payload);
+static void Core_OnCloudMessages(void);
 static void Core_OnChallenge(char *challenge);
 static void Core_OnCreateCSR();
-static void Core_OnReceiveCRT(CBuffer certPayload);
+static void Core_OnReceiveCRT(CBuffer certPayload, bool isCbor);
 static void Core_OnRotateCRT();
 static void Core_OnCertRefresh();
+static void Core_OnRotationConnected(void);
+static void Core_OnRotationFailed(void);
 
 static uint32_t Time_GetTimeMs();
 
 static void Core_EventHandler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
+    CoreEventEnvelope *envelope = (CoreEventEnvelope *)event_data;
+    int64_t latencyUs = esp_timer_get_time() - envelope->postedUs;
+    Stats_Observe(STAT_CORE_EVENT_LATENCY_US, (uint32_t)latencyUs);
+    ESP_LOGD(TAG, "event %d dispatched after %lld us", event_id, latencyUs);
+
+    event_data = envelope->data;
+
     switch ((CoreEvent)event_id)
     {
     case CORE_EVENT_ENROLL:
@@ -67,9 +111,17 @@ static void Core_EventHandler(void *arg, esp_event_base_t event_base, int32_t ev
         break;
     case CORE_EVENT_CONNECTED:
         Core_SetCoreState(CORE_STATE_ONLINE);
+        /* ends once, later reconnections are not traced */
+        TRACE_END(coreState.wifiSpan);
+        NetTask_NetworkUp();
         /* start tcp console */
         Console_TaskStart();
         break;
+    case CORE_EVENT_DISCONNECTED:
+        Core_SetCoreState(CORE_STATE_ENROLLED);
+        /* stop connecting over a dead link until wifi is back */
+        NetTask_NetworkDown();
+        break;
 
     case CORE_EVENT_PUF_CHALLENGE:
     {
@@ -85,78 +137,154 @@ static void Core_EventHandler(void *arg, esp_event_base_t event_base, int32_t ev
     case CORE_EVENT_CERT_REFRESH:
         Core_OnCertRefresh();
         break;
+    case CORE_EVENT_CLOUD_CONNECTING:
+        Core_SetCoreState(CORE_STATE_CLOUD_CONNECTING);
+        break;
+    case CORE_EVENT_CLOUD_CONNECTED:
+        Core_SetCoreState(CORE_STATE_CLOUD_CONNECTED);
+        if (coreState.isCertificateRotationEnabled)
+            Core_OnRotationConnected();
+        break;
+    case CORE_EVENT_CLOUD_DISCONNECTED:
+        Core_SetCoreState(CORE_STATE_ONLINE);
+        break;
+    case CORE_EVENT_CLOUD_CONNECT_FAILED:
+        Core_SetCoreState(CORE_STATE_ONLINE);
+        if (coreState.isCertificateRotationEnabled && ++coreState.rotationAttempts >= CORE_ROTATION_MAX_ATTEMPTS)
+            Core_OnRotationFailed();
+        break;
+    case CORE_EVENT_CLOUD_MESSAGE:
+        Core_OnCloudMessages();
+        break;
     default:
         ESP_LOGI(TAG, "unhandled core event: %d", event_id);
         break;
     }
 }
 
-static void Core_CloudConnect()
+static void Core_PublishTelemetry(void)
 {
-    /* connect to mqtt broker */
-    bool sessionPresent = false;
-    ErrorCode err = Mqtt_Connect(mkCSTRING(DEVICE_ID), &sessionPresent, 1);
+    static TelemetrySample samples[TELEMETRY_BATCH_MAX_SAMPLES];
+    static uint8_t payload[TELEMETRY_BATCH_BUFFER_SIZE];
 
-    if (err)
-        return;
+    ESP_LOGI(TAG, "send telemetry to cloud (%u samples, %lu dropped)", Telemetry_GetPendingCount(), (unsigned long)Telemetry_GetDroppedCount());
 
-    Core_SetCoreState(CORE_STATE_CLOUD_CONNECTED);
+    CString topic = CORE_USE_CBOR ? mkCSTRING(TELEMETRY_TOPIC CBOR_TOPIC_SUFFIX) : mkCSTRING(TELEMETRY_TOPIC);
 
-    if (!sessionPresent)
+    /* one publish carries a whole batch of samples, removed from the ring once handed to the net task */
+    size_t count;
+    while ((count = Telemetry_Peek(samples, TELEMETRY_BATCH_MAX_SAMPLES)) > 0)
     {
-        Mqtt_Subscribe(mkCSTRING(MGT_TOPIC_FILTER));
+        size_t length = CORE_USE_CBOR ? Telemetry_EncodeBatchCbor(samples, count, payload, sizeof(payload))
+                                      : Telemetry_EncodeBatch(samples, count, (char *)payload, sizeof(payload));
+        if (length == 0)
+        {
+            /* would never fit, drop it rather than block the ring */
+            ESP_LOGE(TAG, "telemetry batch does not fit in %u bytes, %u samples dropped", sizeof(payload), count);
+            Telemetry_Consume(count);
+            continue;
+        }
+
+        /* kept for the next period when the net task queue is full */
+        CBuffer data = {.buffer = payload, .length = length};
+        if (NetTask_Publish(topic, data, MQTT_QOS0))
+            return;
+
+        Telemetry_Consume(count);
     }
 }
 
-static void Core_CloudProcessLoop(uint32_t timestamp)
+static void Core_PublishMetrics(void)
 {
-    // send periodic state update
-    if (timestamp - coreState.lastStatePutTimestamp > STATE_UPDATE_INTERVAL)
-    {
-        ESP_LOGI(TAG, "send periodic state update to cloud");
+    static uint8_t payload[STATS_BUFFER_SIZE];
 
-        char topicBuf[50] = {0};
-        CString topic = {
-            .string = topicBuf,
-            .length = snprintf(topicBuf, 50, "%s/temperature", DEVICE_ID)};
+    CString topic = CORE_USE_CBOR ? mkCSTRING(METRICS_TOPIC CBOR_TOPIC_SUFFIX) : mkCSTRING(METRICS_TOPIC);
 
-        char *data = "{\"temp\": \"12.8\"}";
-        CBuffer buffer = {.buffer = (uint8_t *)data, .length = strlen(data)};
-        Mqtt_Publish(topic, buffer);
-        coreState.lastStatePutTimestamp = timestamp;
+    Stats_SampleHeap();
+    Stats_SampleCoreStack();
+    size_t length = CORE_USE_CBOR ? Stats_EncodeCbor(payload, sizeof(payload)) : Stats_Encode((char *)payload, sizeof(payload));
+    if (length == 0)
+    {
+        ESP_LOGE(TAG, "metrics do not fit in %u bytes", sizeof(payload));
+        return;
     }
 
-    // process mqtt loop
-    Mqtt_ProcessLoop();
+    NetTask_Publish(topic, (CBuffer){.buffer = payload, .length = length}, MQTT_QOS0);
 }
 
-static void Core_CloudCallback(CString topic, CBuffer payload)
+static ErrorCode Core_PublishEmpty(CString jsonTopic, CString cborTopic)
 {
-    /* this callback is invoked at each publish message received from MQTT */
-    ESP_LOGI(TAG, "received message from cloud. Topic: %.*s", topic.length, topic.string);
-    // printf("TOPIC=%.*s\r\n", topic.length, topic.string);
-    // printf("DATA=%.*s\r\n", payload.length, payload.buffer);
+    /* empty object in either encoding */
+    static const uint8_t cborEmptyMap[] = {0xA0};
+    static const char jsonEmptyObject[] = "{}";
+
+    if (CORE_USE_CBOR)
+        return NetTask_Publish(cborTopic, (CBuffer){.buffer = cborEmptyMap, .length = sizeof(cborEmptyMap)}, MQTT_QOS1);
+
+    return NetTask_Publish(jsonTopic, (CBuffer){.buffer = (const uint8_t *)jsonEmptyObject, .length = strlen(jsonEmptyObject)}, MQTT_QOS1);
+}
+
+static void Core_CloudProcessLoop(uint32_t timestamp)
+{
+    // send batched telemetry
+    if (timestamp - coreState.lastTelemetryTimestamp >= TELEMETRY_PUBLISH_PERIOD_MS)
+    {
+        Core_PublishTelemetry();
+        coreState.lastTelemetryTimestamp = timestamp;
+    }
 
-    if (strncmp(topic.string, CSR_REQ_TOPIC, topic.length) == 0)
+    // send runtime counters
+    if (timestamp - coreState.lastMetricsTimestamp >= STATS_PUBLISH_PERIOD_MS)
     {
-        /* received CSR request*/
-        Core_OnCreateCSR();
+        Core_PublishMetrics();
+        coreState.lastMetricsTimestamp = timestamp;
     }
+}
 
-    if (strncmp(topic.string, CRT_REQ_TOPIC, topic.length) == 0)
+static void Core_OnCloudMessages(void)
+{
+    /* messages received by the net task, several may be queued behind one event */
+    NetMessage *message;
+    while ((message = NetTask_Receive()) != NULL)
     {
-        /* received signed certificate */
-        Core_OnReceiveCRT(payload);
+        ESP_LOGI(TAG, "received message from cloud. Topic: %.*s", message->topic.length, message->topic.string);
+
+        /* json parsed by handlers lives in the arena until they return */
+        JsonArena_Begin();
+        size_t handled = TopicRouter_Dispatch(message->topic, message->payload);
+        JsonArena_End();
+
+        if (handled == 0)
+            ESP_LOGD(TAG, "no handler for topic %.*s", message->topic.length, message->topic.string);
+
+        NetTask_FreeMessage(message);
     }
 }
 
+static void Core_OnCsrRequest(CString topic, CBuffer payload)
+{
+    /* received CSR request, payload is not used */
+    Core_OnCreateCSR();
+}
+
+static void Core_OnCrtRequest(CString topic, CBuffer payload)
+{
+    /* received signed certificate, the encoding is given by the topic */
+    bool isCbor = topic.length == strlen(CRT_REQ_TOPIC CBOR_TOPIC_SUFFIX);
+    Core_OnReceiveCRT(payload, isCbor);
+}
+
 static void Core_OnChallenge(char *challenge)
 {
     uint8_t response[STR_CHALL_MAX_LEN] = {0};
     char resHex[STR_CHALL_MAX_LEN * 2] = {0};
     char *resHexPtr = resHex;
 
+    Crypto_PufLock();
+    Stats_Increment(STAT_PUF_ATTEMPTS);
     bool puf_ok = get_puf_response();
+    if (!puf_ok)
+        Stats_Increment(STAT_PUF_FAILURES);
     if (PUF_STATE == RESPONSE_READY && puf_ok)
     {
         for (size_t i = 0; i < strlen(challenge); i++)
@@ -167,6 +295,7 @@ static void Core_OnChallenge(char *challenge)
     }
 
     clean_puf_response();
+    Crypto_PufUnlock();
 
     Http_SendResponse(resHex);
 }
@@ -176,27 +305,52 @@ static void Core_OnCreateCSR()
     ESP_LOGI(TAG, "start CSR generation");
 
     /* create temporary cert */
-    Buffer csr;
+    Buffer csr = {0};
     ErrorCode err = Crypto_RefreshCertificate(&csr);
 
+    if (!err && CORE_USE_CBOR)
+    {
+        /* der is sent as is in a byte string */
+        uint8_t dataBuf[CORE_CBOR_CSR_MAX_SIZE];
+        CborWriter writer;
+        CBuffer data;
+
+        Cbor_WriterInit(&writer, dataBuf, sizeof(dataBuf));
+        Cbor_WriteMap(&writer, 1);
+        Cbor_WriteText(&writer, "csr", 3);
+        Cbor_WriteBytes(&writer, csr.buffer, csr.length);
+
+        if (!Cbor_WriterFinish(&writer, &data))
+            NetTask_Publish(mkCSTRING(CSR_RES_TOPIC CBOR_TOPIC_SUFFIX), data, MQTT_QOS1);
+        else
+            ESP_LOGE(TAG, "csr does not fit in %u bytes", sizeof(dataBuf));
+
+        free(csr.buffer);
+        return;
+    }
+
+    /* csr is stored as der, json carries pem */
+    Buffer csrPem = {0};
+    if (!err)
+        err = Crypto_DerToPem(CRYPTO_PEM_CSR, (CBuffer){.buffer = csr.buffer, .length = csr.length}, &csrPem);
+
     if (!err)
     {
-        size_t dataBufMaxSize = 20 + csr.length;
+        size_t dataBufMaxSize = 20 + csrPem.length;
         uint8_t *dataBuf = (uint8_t *)calloc(dataBufMaxSize, sizeof(uint8_t));
-        size_t dataLen = snprintf((char *)dataBuf, dataBufMaxSize, "{\"csr\": \"%.*s\"}", csr.length, csr.buffer);
+        size_t dataLen = snprintf((char *)dataBuf, dataBufMaxSize, "{\"csr\": \"%.*s\"}", csrPem.length, csrPem.buffer);
         CBuffer data = {.buffer = dataBuf, .length = dataLen};
         CString topic = mkCSTRING(CSR_RES_TOPIC);
-        Mqtt_Publish(topic, data);
+        NetTask_Publish(topic, data, MQTT_QOS1);
         free(dataBuf);
     }
 
+    free(csrPem.buffer);
     free(csr.buffer);
 }
 
-static void Core_OnReceiveCRT(CBuffer certPayload)
+static ErrorCode Core_ParseCRTJson(CBuffer certPayload, Buffer *outCert)
 {
-    ESP_LOGI(TAG, "received new CRT");
-
     const cJSON *certificatePem = NULL;
     const cJSON *length = NULL;
 
@@ -208,53 +362,85 @@ static void Core_OnReceiveCRT(CBuffer certPayload)
     if (!cJSON_IsString(certificatePem) || !cJSON_IsNumber(length))
     {
         cJSON_Delete(certJson);
-        return;
+        return FAILURE;
     }
 
-    /* save temporary cert */
-    Buffer cert = {.buffer = (uint8_t *)certificatePem->valuestring, .length = length->valueint};
-    Nvs_SetBuffer(NVS_DEVICE_CERT_KEY_TMP, cert);
+    /* save temporary cert as der */
+    CBuffer certPem = {.buffer = (uint8_t *)certificatePem->valuestring, .length = length->valueint};
+    ErrorCode err = Crypto_PemToDer(CRYPTO_PEM_CERTIFICATE, certPem, outCert);
     cJSON_Delete(certJson);
 
-    /* send event to core to test new connection */
-    Core_EventNotify(CORE_EVENT_CERT_REFRESH);
+    return err;
 }
 
-static void Core_OnCertRefresh()
+static ErrorCode Core_ParseCRTCbor(CBuffer certPayload, Buffer *outCert)
 {
-    ESP_LOGI(TAG, "start certificate rotation");
-    coreState.isCertificateRotationEnabled = true;
-
-    /* disconnect from cloud */
-    ErrorCode err = Mqtt_Disconnect(false);
-    if (err)
-        return;
+    /* certificate already comes as der */
+    CborItem certificateDer;
+    if (Cbor_MapFind(certPayload, "certificateDer", &certificateDer) || certificateDer.type != CBOR_TYPE_BYTES)
+        return FAILURE;
+
+    outCert->buffer = (uint8_t *)malloc(certificateDer.value);
+    if (!outCert->buffer)
+        return FAILURE;
+
+    memcpy(outCert->buffer, certificateDer.data, certificateDer.value);
+    outCert->length = certificateDer.value;
+    return SUCCESS;
+}
 
-    /* connect using new certificate */
-    bool sessionPresent = false;
-    err = Mqtt_Connect(mkCSTRING(DEVICE_ID), &sessionPresent, 3);
+static void Core_OnReceiveCRT(CBuffer certPayload, bool isCbor)
+{
+    ESP_LOGI(TAG, "received new CRT (%s)", isCbor ? "cbor" : "json");
 
-    char *dataBuf = "{}";
-    CBuffer data = {.buffer = (uint8_t *)dataBuf, .length = strlen(dataBuf)};
-    coreState.isCertificateRotationEnabled = false;
+    Buffer cert;
+    ErrorCode err = isCbor ? Core_ParseCRTCbor(certPayload, &cert) : Core_ParseCRTJson(certPayload, &cert);
 
     if (err)
     {
-        /* failure, send ERR message */
-        ESP_LOGE(TAG, "rotation: failure on connection with new cert");
-        Mqtt_Connect(mkCSTRING(DEVICE_ID), &sessionPresent, 3);
-        CString topic = mkCSTRING(CRT_ERR_TOPIC);
-        Mqtt_Publish(topic, data);
+        Stats_Increment(STAT_DECODE_ERRORS);
+        ESP_LOGE(TAG, "received invalid certificate");
         return;
     }
 
+    Nvs_SetBuffer(NVS_DEVICE_CERT_KEY_TMP, cert);
+    free(cert.buffer);
+
+    /* already on the core task, test the new connection right away */
+    Core_OnCertRefresh();
+}
+
+static void Core_OnCertRefresh()
+{
+    ESP_LOGI(TAG, "start certificate rotation");
+    coreState.isCertificateRotationEnabled = true;
+    coreState.rotationAttempts = 0;
+
+    /* connect using new certificate, the outcome comes back as a cloud event */
+    if (NetTask_Reconnect())
+        coreState.isCertificateRotationEnabled = false;
+}
+
+static void Core_OnRotationConnected(void)
+{
+    coreState.isCertificateRotationEnabled = false;
+
     /* success, rotate certificates */
     Core_OnRotateCRT();
 
     /* send ACK message */
     ESP_LOGI(TAG, "rotation: successfully connected with new cert");
-    CString topic = mkCSTRING(CRT_ACK_TOPIC);
-    Mqtt_Publish(topic, data);
+    Core_PublishEmpty(mkCSTRING(CRT_ACK_TOPIC), mkCSTRING(CRT_ACK_TOPIC CBOR_TOPIC_SUFFIX));
+}
+
+static void Core_OnRotationFailed(void)
+{
+    coreState.isCertificateRotationEnabled = false;
+
+    /* failure, go back to the current cert and send ERR message once reconnected */
+    ESP_LOGE(TAG, "rotation: failure on connection with new cert");
+    NetTask_Reconnect();
+    Core_PublishEmpty(mkCSTRING(CRT_ERR_TOPIC), mkCSTRING(CRT_ERR_TOPIC CBOR_TOPIC_SUFFIX));
 }
 
 static void Core_OnRotateCRT()
@@ -272,6 +458,9 @@ static void Core_OnRotateCRT()
         Nvs_SetBuffer(NVS_DEVICE_CERT_KEY, crt);
         Nvs_SetBuffer(NVS_DEVICE_SALT_KEY, salt);
         ESP_LOGI(TAG, "sucessfully updated certificate");
+
+        /* stored certificate changed, reparse it on next connection */
+        NetTask_InvalidateCredentials();
     }
 
     free(csr.buffer);
@@ -300,10 +489,46 @@ const char *Core_GetSaltNvsKey()
     return NVS_DEVICE_SALT_KEY;
 }
 
+static void Core_MigrateCredential(const char *key, CryptoPemType type)
+{
+    Buffer stored;
+    if (!Nvs_GetBuffer(key, &stored))
+        return;
+
+    CBuffer data = {.buffer = stored.buffer, .length = stored.length};
+    if (Crypto_IsPem(data))
+    {
+        /* convert legacy pem entry to der */
+        Buffer der;
+        if (Crypto_PemToDer(type, data, &der) == SUCCESS)
+        {
+            Nvs_SetBuffer(key, der);
+            ESP_LOGI(TAG, "migrated %s to der (%u -> %u bytes)", key, stored.length, der.length);
+            free(der.buffer);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "failed to migrate %s to der", key);
+        }
+    }
+
+    free(stored.buffer);
+}
+
+static void Core_MigrateCredentials(void)
+{
+    Core_MigrateCredential(NVS_DEVICE_CERT_KEY, CRYPTO_PEM_CERTIFICATE);
+    Core_MigrateCredential(NVS_DEVICE_CERT_KEY_TMP, CRYPTO_PEM_CERTIFICATE);
+    Core_MigrateCredential(NVS_DEVICE_CSR_KEY, CRYPTO_PEM_CSR);
+    Core_MigrateCredential(NVS_DEVICE_CSR_KEY_TMP, CRYPTO_PEM_CSR);
+}
+
 static void Core_EnrollPuf(void)
 {
     Core_SetCoreState(CORE_STATE_NOT_ENROLLED);
+    Crypto_PufLock();
     enroll_puf();
+    Crypto_PufUnlock();
 }
 
 static void Core_TaskSetup(void)
@@ -316,11 +541,38 @@ static void Core_TaskSetup(void)
 
     Core_SetCoreState(CORE_STATE_ENROLLED);
 
+    /* convert certificates and csr stored as pem by previous firmware */
+    Core_MigrateCredentials();
+
+    /* wakes the core task when an event is posted */
+    ESP_ERROR_CHECK(esp_vfs_eventfd_register(&(esp_vfs_eventfd_config_t)ESP_VFS_EVENTD_CONFIG_DEFAULT()));
+    coreState.wakeFd = eventfd(0, 0);
+    assert(coreState.wakeFd >= 0);
+
     /* start wifi connection */
+    coreState.wifiSpan = TRACE_BEGIN("wifi_connect");
     Wifi_Init();
 
-    /* setup mqtt */
-    Mqtt_Init(Core_CloudCallback);
+    /* cJSON allocations of message handlers go to an arena */
+    JsonArena_Init();
+
+    /* certificate messages may exceed the mqtt buffer, the net task assembles them */
+    NetTask_RegisterLargeTopic(mkCSTRING(CRT_REQ_TOPIC));
+    NetTask_RegisterLargeTopic(mkCSTRING(CRT_REQ_TOPIC CBOR_TOPIC_SUFFIX));
+
+    /* handlers of the cloud messages */
+    TopicRouter_Register(mkCSTRING(CSR_REQ_TOPIC), Core_OnCsrRequest);
+    TopicRouter_Register(mkCSTRING(CSR_REQ_TOPIC CBOR_TOPIC_SUFFIX), Core_OnCsrRequest);
+    TopicRouter_Register(mkCSTRING(CRT_REQ_TOPIC), Core_OnCrtRequest);
+    TopicRouter_Register(mkCSTRING(CRT_REQ_TOPIC CBOR_TOPIC_SUFFIX), Core_OnCrtRequest);
+
+    /* start sampling, batches are published once connected */
+    Telemetry_RegisterSource(&Telemetry_SyntheticSource);
+    Telemetry_RegisterSource(&Telemetry_HeapSource);
+    Telemetry_Start();
+
+    /* challenge responses are posted by their own task over a kept-alive connection */
+    ESP_ERROR_CHECK(Http_Start());
 }
 
 static uint32_t Time_GetTimeMs()
@@ -330,6 +582,41 @@ static uint32_t Time_GetTimeMs()
     return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
 }
 
+static uint32_t Core_TimeUntil(uint32_t timestamp, uint32_t last, uint32_t interval)
+{
+    uint32_t elapsed = timestamp - last;
+    return elapsed >= interval ? 0 : interval - elapsed;
+}
+
+static uint32_t Core_GetWaitMs(uint32_t timestamp)
+{
+    /* the connection is driven by the net task, only telemetry and metrics are scheduled here */
+    switch (coreState.state)
+    {
+    case CORE_STATE_CLOUD_CONNECTED:
+        return MIN(Core_TimeUntil(timestamp, coreState.lastTelemetryTimestamp, TELEMETRY_PUBLISH_PERIOD_MS),
+                   Core_TimeUntil(timestamp, coreState.lastMetricsTimestamp, STATS_PUBLISH_PERIOD_MS));
+    default:
+        return CORE_TASK_IDLE_WAIT_MS;
+    }
+}
+
+static void Core_WaitForActivity(uint32_t waitMs, uint64_t *outPostedEvents)
+{
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    FD_SET(coreState.wakeFd, &readFds);
+
+    *outPostedEvents = 0;
+
+    struct timeval timeout = {.tv_sec = waitMs / 1000, .tv_usec = (waitMs % 1000) * 1000};
+    if (select(coreState.wakeFd + 1, &readFds, NULL, NULL, &timeout) <= 0)
+        return;
+
+    /* the eventfd counter holds the number of posts since the last read */
+    read(coreState.wakeFd, outPostedEvents, sizeof(uint64_t));
+}
+
 static void Core_TaskMain(void *pvParameters)
 {
     ESP_LOGI(TAG, "setting up core task");
@@ -345,35 +632,31 @@ static void Core_TaskMain(void *pvParameters)
     /* register the handler for the core events */
     ESP_ERROR_CHECK(esp_event_handler_instance_register_with(loop_core_task, CORE_EVENT, ESP_EVENT_ANY_ID, Core_EventHandler, loop_core_task, NULL));
 
+    /* mqtt runs in its own task, it reports back through core events */
+    ESP_ERROR_CHECK(NetTask_Start(mkCSTRING(DEVICE_ID), mkCSTRING(MGT_TOPIC_FILTER)));
+
     uint32_t timestamp = 0;
+    uint64_t postedEvents = 0;
 
     while (true)
     {
         ESP_LOGD(TAG, "running core task (%d)", coreState.state);
         ESP_LOGD(TAG, "free memory: %d bytes", esp_get_free_heap_size());
         ESP_LOGD(TAG, "task watermark: %d bytes", uxTaskGetStackHighWaterMark(NULL));
+        Stats_SampleHeap();
+        Stats_SampleCoreStack();
 
         timestamp = Time_GetTimeMs();
 
-        switch (coreState.state)
-        {
-        case CORE_STATE_ONLINE:
-            if ((timestamp - coreState.lastCloudConnectionTimestamp > CLOUD_RECONNECTION_INTERVAL) || coreState.lastCloudConnectionTimestamp == 0)
-            {
-                coreState.lastCloudConnectionTimestamp = timestamp;
-                /* connect to cloud */
-                Core_CloudConnect();
-            }
-
-            break;
-        case CORE_STATE_CLOUD_CONNECTED:
+        if (coreState.state == CORE_STATE_CLOUD_CONNECTED)
             Core_CloudProcessLoop(timestamp);
-        default:
-            break;
-        }
 
-        esp_event_loop_run(loop_core_task, 100);
-        vTaskDelay(pdMS_TO_TICKS(CORE_TASK_PERIOD_MS));
+        /* sleep until an event is posted or the next deadline */
+        Core_WaitForActivity(Core_GetWaitMs(Time_GetTimeMs()), &postedEvents);
+
+        /* each run dispatches at most one event */
+        for (uint64_t i = 0; i < postedEvents; i++)
+            esp_event_loop_run(loop_core_task, 0);
     }
 
     /* unregister event handler */
@@ -398,7 +681,28 @@ void Core_SetCoreState(CoreState newState)
 
 void Core_EventNotifyData(CoreEvent event_id, void *event_data, size_t event_data_size)
 {
-    ESP_ERROR_CHECK(esp_event_post_to(loop_core_task, CORE_EVENT, event_id, event_data, event_data_size, portMAX_DELAY));
+    if (event_data_size > CORE_EVENT_MAX_DATA_SIZE)
+    {
+        ESP_LOGE(TAG, "event %d data too large (%u bytes)", event_id, event_data_size);
+        return;
+    }
+
+    CoreEventEnvelope envelope = {.postedUs = esp_timer_get_time()};
+    if (event_data_size > 0)
+        memcpy(envelope.data, event_data, event_data_size);
+
+    /* only the core task drains the queue, it must never wait on it */
+    TickType_t wait = xTaskGetCurrentTaskHandle() == coreState.taskHandle ? 0 : portMAX_DELAY;
+    esp_err_t err = esp_event_post_to(loop_core_task, CORE_EVENT, event_id, &envelope, offsetof(CoreEventEnvelope, data) + event_data_size, wait);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "event %d dropped: %s", event_id, esp_err_to_name(err));
+        return;
+    }
+
+    /* wake the core task */
+    uint64_t posted = 1;
+    write(coreState.wakeFd, &posted, sizeof(posted));
 }
 
 void Core_EventNotify(CoreEvent event_id)
@@ -412,5 +716,5 @@ void Core_TaskStart(void)
     Core_TaskSetup();
 
     /* start task core */
-    xTaskCreate(Core_TaskMain, "core_task", 20000, NULL, uxTaskPriorityGet(NULL) + 1, NULL);
+    xTaskCreate(Core_TaskMain, "core_task", 20000, NULL, uxTaskPriorityGet(NULL) + 1, &coreState.taskHandle);
 }
\ No newline at end of file
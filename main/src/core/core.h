@@ -7,10 +7,16 @@ ESP_EVENT_DECLARE_BASE(CORE_EVENT);
 typedef enum CoreEvent
 {
     CORE_EVENT_CONNECTED,
+    CORE_EVENT_DISCONNECTED,
     CORE_EVENT_ENROLL,
     CORE_EVENT_PUF_CHALLENGE,
     CORE_EVENT_CERT_ROTATION,
     CORE_EVENT_CERT_REFRESH,
+    CORE_EVENT_CLOUD_CONNECTING,
+    CORE_EVENT_CLOUD_CONNECTED,
+    CORE_EVENT_CLOUD_DISCONNECTED,
+    CORE_EVENT_CLOUD_CONNECT_FAILED,
+    CORE_EVENT_CLOUD_MESSAGE,
 } CoreEvent;
 
 typedef enum CoreState
@@ -19,6 +25,7 @@ typedef enum CoreState
     CORE_STATE_NOT_ENROLLED,
     CORE_STATE_ENROLLED,
     CORE_STATE_ONLINE,
+    CORE_STATE_CLOUD_CONNECTING,
     CORE_STATE_CLOUD_CONNECTED,
 
 } CoreState;
@@ -0,0 +1,78 @@
+#include "core/json_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cJSON.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define JSON_ARENA_ALIGN 8
+
+static const char *TAG = "JsonArena";
+
+static struct
+{
+    uint8_t buffer[JSON_ARENA_SIZE] __attribute__((aligned(JSON_ARENA_ALIGN)));
+    size_t offset;
+    size_t peak;
+    size_t fallbacks;
+    TaskHandle_t owner; /* task inside Begin/End, NULL when inactive */
+} jsonArena = {0};
+
+static void *JsonArena_Malloc(size_t size)
+{
+    /* other tasks and oversized messages use the heap */
+    if (jsonArena.owner != xTaskGetCurrentTaskHandle())
+        return malloc(size);
+
+    size_t aligned = (size + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1);
+    if (aligned > JSON_ARENA_SIZE - jsonArena.offset)
+    {
+        jsonArena.fallbacks++;
+        return malloc(size);
+    }
+
+    void *ptr = &jsonArena.buffer[jsonArena.offset];
+    jsonArena.offset += aligned;
+    return ptr;
+}
+
+static void JsonArena_Free(void *ptr)
+{
+    /* arena memory is released all at once in JsonArena_End */
+    uint8_t *bytes = (uint8_t *)ptr;
+    if (bytes >= jsonArena.buffer && bytes < jsonArena.buffer + JSON_ARENA_SIZE)
+        return;
+
+    free(ptr);
+}
+
+void JsonArena_Init(void)
+{
+    cJSON_Hooks hooks = {
+        .malloc_fn = JsonArena_Malloc,
+        .free_fn = JsonArena_Free,
+    };
+
+    cJSON_InitHooks(&hooks);
+}
+
+void JsonArena_Begin(void)
+{
+    jsonArena.offset = 0;
+    jsonArena.fallbacks = 0;
+    jsonArena.owner = xTaskGetCurrentTaskHandle();
+}
+
+void JsonArena_End(void)
+{
+    if (jsonArena.offset > jsonArena.peak)
+        jsonArena.peak = jsonArena.offset;
+
+    ESP_LOGD(TAG, "message used %u bytes (peak %u, heap fallbacks %u)", jsonArena.offset, jsonArena.peak, jsonArena.fallbacks);
+
+    jsonArena.owner = NULL;
+    jsonArena.offset = 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "core/error.h"
+
+/* bump arena backing cJSON while a message handler runs */
+#define JSON_ARENA_SIZE 4096
+
+void JsonArena_Init(void);
+void JsonArena_Begin(void);
+void JsonArena_End(void);
@@ -1,13 +1,16 @@
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "esp_timer.h"
 
 #include "define.h"
 #include "core/nvs.h"
+#include "telemetry/stats.h"
 
 #define NVS_NAMESPACE "storage"
 
 static bool Nvs_GetBlob(const char *key, uint8_t **blob, size_t *length)
 {
+    int64_t startUs = esp_timer_get_time();
     nvs_handle_t nvs_handle;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
     ESP_ERROR_CHECK(err);
@@ -25,11 +28,14 @@ static bool Nvs_GetBlob(const char *key, uint8_t **blob, size_t *length)
     ESP_ERROR_CHECK(err);
     nvs_close(nvs_handle);
 
+    Stats_Observe(STAT_NVS_READ_US, esp_timer_get_time() - startUs);
+
     return true;
 }
 
 static void Nvs_SetBlob(const char *key, const uint8_t *blob, size_t length)
 {
+    int64_t startUs = esp_timer_get_time();
     nvs_handle_t nvs_handle;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
     ESP_ERROR_CHECK(err);
@@ -41,6 +47,8 @@ static void Nvs_SetBlob(const char *key, const uint8_t *blob, size_t length)
     ESP_ERROR_CHECK(err);
 
     nvs_close(nvs_handle);
+
+    Stats_Observe(STAT_NVS_WRITE_US, esp_timer_get_time() - startUs);
 }
 
 bool Nvs_CheckKey(const char *key)
@@ -0,0 +1,92 @@
+#include "core/rtc_store.h"
+
+#include "crypto/crypto.h"
+
+#include "mbedtls/md.h"
+#include "mbedtls/platform_util.h"
+#include "esp_log.h"
+
+#include <string.h>
+
+#define RTC_STORE_KEY_LABEL "rtc-store"
+
+static const char *TAG = "RtcStore";
+
+/* derived once per boot and kept in ordinary RAM, never in RTC memory */
+static uint8_t storeKey[RTC_STORE_MAC_LEN];
+static bool isKeyReady;
+
+static bool RtcStore_GetKey(void)
+{
+    if (isKeyReady)
+        return true;
+
+    if (Crypto_DeriveDeviceKey(RTC_STORE_KEY_LABEL, storeKey, sizeof(storeKey)) != SUCCESS)
+    {
+        ESP_LOGW(TAG, "no device key, rtc store disabled");
+        return false;
+    }
+
+    isKeyReady = true;
+    return true;
+}
+
+static bool RtcStore_Mac(uint32_t magic, uint32_t length, const void *data, uint8_t *outMac)
+{
+    if (!RtcStore_GetKey())
+        return false;
+
+    mbedtls_md_context_t md;
+    mbedtls_md_init(&md);
+    int ret = mbedtls_md_setup(&md, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+
+    /* mac covers the header fields too, so a stale length is detected */
+    if (ret == 0)
+        ret = mbedtls_md_hmac_starts(&md, storeKey, sizeof(storeKey));
+    if (ret == 0)
+        ret = mbedtls_md_hmac_update(&md, (const unsigned char *)&magic, sizeof(magic));
+    if (ret == 0)
+        ret = mbedtls_md_hmac_update(&md, (const unsigned char *)&length, sizeof(length));
+    if (ret == 0)
+        ret = mbedtls_md_hmac_update(&md, (const unsigned char *)data, length);
+    if (ret == 0)
+        ret = mbedtls_md_hmac_finish(&md, outMac);
+
+    mbedtls_md_free(&md);
+    return ret == 0;
+}
+
+void RtcStore_Seal(RtcStoreHeader *header, uint32_t magic, const void *data, size_t length)
+{
+    if (!RtcStore_Mac(magic, length, data, header->mac))
+    {
+        RtcStore_Clear(header);
+        return;
+    }
+
+    header->magic = magic;
+    header->length = length;
+}
+
+bool RtcStore_Verify(const RtcStoreHeader *header, uint32_t magic, const void *data, size_t maxLength)
+{
+    /* nothing stored since the last power-on reset */
+    if (header->magic != magic || header->length > maxLength)
+        return false;
+
+    uint8_t mac[RTC_STORE_MAC_LEN] = {0};
+    if (!RtcStore_Mac(header->magic, header->length, data, mac))
+        return false;
+
+    /* constant time, the comparison must not leak how many bytes matched */
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(mac); i++)
+        diff |= mac[i] ^ header->mac[i];
+
+    return diff == 0;
+}
+
+void RtcStore_Clear(RtcStoreHeader *header)
+{
+    mbedtls_platform_zeroize(header, sizeof(RtcStoreHeader));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
+
+#define RTC_STORE_MAC_LEN 32
+
+/* header placed in front of data kept in RTC slow memory across deep sleep.
+ * the mac is HMAC-SHA256 keyed with a PUF-derived device key, so forged or
+ * corrupted data is rejected. the data itself is stored in plaintext: anyone
+ * able to read RTC memory can read it, including the TLS session secret */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t length;
+    uint8_t mac[RTC_STORE_MAC_LEN];
+} RtcStoreHeader;
+
+void RtcStore_Seal(RtcStoreHeader *header, uint32_t magic, const void *data, size_t length);
+bool RtcStore_Verify(const RtcStoreHeader *header, uint32_t magic, const void *data, size_t maxLength);
+void RtcStore_Clear(RtcStoreHeader *header);
@@ -0,0 +1,46 @@
+#include "core/spsc_queue.h"
+
+#include <assert.h>
+
+void SpscQueue_Init(SpscQueue *queue, void **slots, size_t capacity)
+{
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+    queue->slots = slots;
+    queue->capacity = capacity;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+bool SpscQueue_Push(SpscQueue *queue, void *item)
+{
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head - tail == queue->capacity)
+        return false;
+
+    queue->slots[head & (queue->capacity - 1)] = item;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+void *SpscQueue_Pop(SpscQueue *queue)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (head == tail)
+        return NULL;
+
+    void *item = queue->slots[tail & (queue->capacity - 1)];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return item;
+}
+
+size_t SpscQueue_Count(SpscQueue *queue)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    return head - tail;
+}
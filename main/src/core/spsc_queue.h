@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* lock-free queue of pointers, one producer task and one consumer task */
+typedef struct SpscQueue
+{
+    void **slots;
+    size_t capacity; /* power of two */
+    atomic_size_t head;
+    atomic_size_t tail;
+} SpscQueue;
+
+void SpscQueue_Init(SpscQueue *queue, void **slots, size_t capacity);
+bool SpscQueue_Push(SpscQueue *queue, void *item);
+void *SpscQueue_Pop(SpscQueue *queue);
+size_t SpscQueue_Count(SpscQueue *queue);
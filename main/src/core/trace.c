@@ -0,0 +1,128 @@
+#include "core/trace.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+uint32_t Trace_NowUs(void)
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+void Trace_End(TraceSpan *span)
+{
+    /* a span ends once, a second end is a no-op */
+    if (!span->name)
+        return;
+
+    Trace_Record(span->name, span->startUs);
+    span->name = NULL;
+}
+
+#ifdef CONFIG_TRACE_ENABLED
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "trace ring size must be a power of two");
+
+typedef struct TraceSlot
+{
+    TraceRecord record;
+    atomic_uint sequence; /* position + 1 once the record is complete */
+} TraceSlot;
+
+/* one ring per core, tasks of the same core reserve slots with an atomic increment */
+static struct
+{
+    TraceSlot slots[TRACE_RING_SIZE];
+    atomic_uint head;
+} rings[portNUM_PROCESSORS];
+
+void Trace_Record(const char *name, uint32_t startUs)
+{
+    uint32_t now = Trace_NowUs();
+    uint8_t core = (uint8_t)xPortGetCoreID();
+
+    unsigned int position = atomic_fetch_add_explicit(&rings[core].head, 1, memory_order_relaxed);
+    TraceSlot *slot = &rings[core].slots[position & (TRACE_RING_SIZE - 1)];
+
+    /* readers skip the slot while it is rewritten */
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->record.name = name;
+    slot->record.startUs = startUs;
+    slot->record.durationUs = now - startUs;
+    slot->record.core = core;
+
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+}
+
+uint32_t Trace_ForEach(TraceVisitor visitor, void *ctx)
+{
+    uint32_t overwritten = 0;
+
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        unsigned int head = atomic_load_explicit(&rings[core].head, memory_order_acquire);
+        unsigned int first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        overwritten += first;
+
+        for (unsigned int position = first; position != head; position++)
+        {
+            TraceSlot *slot = &rings[core].slots[position & (TRACE_RING_SIZE - 1)];
+            if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != position + 1)
+                continue;
+
+            TraceRecord record = slot->record;
+
+            /* drop the copy if a writer wrapped around meanwhile */
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != position + 1)
+                continue;
+
+            visitor(&record, ctx);
+        }
+    }
+
+    return overwritten;
+}
+
+void Trace_Clear(void)
+{
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        for (size_t i = 0; i < TRACE_RING_SIZE; i++)
+            atomic_store(&rings[core].slots[i].sequence, 0);
+
+        atomic_store(&rings[core].head, 0);
+    }
+}
+
+bool Trace_IsEnabled(void)
+{
+    return true;
+}
+
+#else
+
+void Trace_Record(const char *name, uint32_t startUs)
+{
+}
+
+uint32_t Trace_ForEach(TraceVisitor visitor, void *ctx)
+{
+    return 0;
+}
+
+void Trace_Clear(void)
+{
+}
+
+bool Trace_IsEnabled(void)
+{
+    return false;
+}
+
+#endif
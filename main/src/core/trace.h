@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* slots of the ring of each core, power of two */
+#define TRACE_RING_SIZE CONFIG_TRACE_RING_SIZE
+
+/* a span is opened by TRACE_BEGIN and written to the ring of the current core by TRACE_END */
+typedef struct TraceSpan
+{
+    const char *name; /* string literal, NULL once ended */
+    uint32_t startUs;
+} TraceSpan;
+
+typedef struct TraceRecord
+{
+    const char *name;
+    uint32_t startUs;
+    uint32_t durationUs;
+    uint8_t core;
+} TraceRecord;
+
+typedef void (*TraceVisitor)(const TraceRecord *record, void *ctx);
+
+#ifdef CONFIG_TRACE_ENABLED
+#define TRACE_BEGIN(spanName) ((TraceSpan){.name = (spanName), .startUs = Trace_NowUs()})
+#define TRACE_END(span) Trace_End(&(span))
+#define TRACE_SINCE_BOOT(spanName) Trace_Record((spanName), 0)
+#else
+#define TRACE_BEGIN(spanName) ((TraceSpan){0})
+#define TRACE_END(span) ((void)(span))
+#define TRACE_SINCE_BOOT(spanName) ((void)(spanName))
+#endif
+
+uint32_t Trace_NowUs(void);
+void Trace_Record(const char *name, uint32_t startUs);
+void Trace_End(TraceSpan *span);
+
+/* visits the records of every core, oldest first, returns how many were overwritten */
+uint32_t Trace_ForEach(TraceVisitor visitor, void *ctx);
+void Trace_Clear(void);
+bool Trace_IsEnabled(void);
@@ -7,12 +7,20 @@
 #include "mbedtls/platform.h"
 #include "mbedtls/pk.h"
 #include "mbedtls/x509_csr.h"
+#include "mbedtls/pem.h"
+#include "mbedtls/md.h"
+#include "mbedtls/platform_util.h"
 #include "esp_log.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
 #include "puf_sec.h"
 #include "define.h"
 #include "core/nvs.h"
 #include "core/core.h"
+#include "core/trace.h"
+#include "telemetry/stats.h"
 #include "crypto/crypto.h"
 
 static const char *TAG = "Crypto";
@@ -31,40 +39,113 @@ static const char *TAG = "Crypto";
 /* csr max length */
 #define CSR_BUF_MAX_LEN 500
 
-ErrorCode Crypto_SeedCtrDrbg(mbedtls_ctr_drbg_context *ctrDrbg, mbedtls_entropy_context *entropy)
+/* number of requests served by the shared drbg before it reseeds from the entropy pool */
+#define DRBG_RESEED_INTERVAL 1000
+
+/* personalization string mixed in the drbg seed */
+#define DRBG_PERSONALIZATION DEVICE_ID "-drbg"
+
+/* process-wide drbg, seeded once and shared by every mbedtls user */
+static struct
+{
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctrDrbg;
+    SemaphoreHandle_t mutex;
+    bool isSeeded;
+} drbg = {0};
+
+/* the sram puf buffer is shared by the core, net and console tasks */
+static SemaphoreHandle_t pufMutex = NULL;
+
+ErrorCode Crypto_Init(void)
 {
-    return mbedtls_ctr_drbg_seed(ctrDrbg, mbedtls_entropy_func, entropy, NULL, 0);
+    if (drbg.isSeeded)
+        return SUCCESS;
+
+    if (!pufMutex)
+        pufMutex = xSemaphoreCreateMutex();
+    if (!pufMutex)
+    {
+        ESP_LOGE(TAG, "failed to create puf mutex");
+        return FAILURE;
+    }
+
+    drbg.mutex = xSemaphoreCreateMutex();
+    if (!drbg.mutex)
+    {
+        ESP_LOGE(TAG, "failed to create drbg mutex");
+        return FAILURE;
+    }
+
+    mbedtls_entropy_init(&drbg.entropy);
+    mbedtls_ctr_drbg_init(&drbg.ctrDrbg);
+
+    const char *personalization = DRBG_PERSONALIZATION;
+    int err = mbedtls_ctr_drbg_seed(&drbg.ctrDrbg, mbedtls_entropy_func, &drbg.entropy, (const unsigned char *)personalization, strlen(personalization));
+    if (err)
+    {
+        ESP_LOGE(TAG, "failed to seed drbg: -0x%04X", -err);
+        mbedtls_ctr_drbg_free(&drbg.ctrDrbg);
+        mbedtls_entropy_free(&drbg.entropy);
+        vSemaphoreDelete(drbg.mutex);
+        drbg.mutex = NULL;
+        return FAILURE;
+    }
+
+    /* reseed with fresh entropy periodically instead of on each consumer */
+    mbedtls_ctr_drbg_set_reseed_interval(&drbg.ctrDrbg, DRBG_RESEED_INTERVAL);
+    mbedtls_ctr_drbg_set_prediction_resistance(&drbg.ctrDrbg, MBEDTLS_CTR_DRBG_PR_OFF);
+
+    drbg.isSeeded = true;
+    ESP_LOGI(TAG, "drbg seeded (reseed interval: %d)", DRBG_RESEED_INTERVAL);
+
+    return SUCCESS;
 }
 
-ErrorCode Crypto_GetRandomSalt(Buffer *outSalt)
+int Crypto_Random(void *ctx, unsigned char *output, size_t length)
 {
-    ErrorCode err = SUCCESS;
+    (void)ctx;
 
-    mbedtls_ctr_drbg_context ctrDrbg;
-    mbedtls_entropy_context entropy;
-    mbedtls_ctr_drbg_init(&ctrDrbg);
-    mbedtls_entropy_init(&entropy);
+    if (!drbg.isSeeded)
+        return MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
 
-    err = Crypto_SeedCtrDrbg(&ctrDrbg, &entropy);
-    ERROR_CHECK(err);
+    xSemaphoreTake(drbg.mutex, portMAX_DELAY);
+    int err = mbedtls_ctr_drbg_random(&drbg.ctrDrbg, output, length);
+    xSemaphoreGive(drbg.mutex);
 
-    err = mbedtls_ctr_drbg_random(&ctrDrbg, outSalt->buffer, outSalt->length);
-    ESP_LOGD(TAG, "generated salt: %.*s", outSalt->length, outSalt->buffer);
+    return err;
+}
 
-    mbedtls_ctr_drbg_free(&ctrDrbg);
-    mbedtls_entropy_free(&entropy);
+ErrorCode Crypto_GetRandomSalt(Buffer *outSalt)
+{
+    ErrorCode err = Crypto_Random(NULL, outSalt->buffer, outSalt->length);
+    ESP_LOGD(TAG, "generated salt: %.*s", outSalt->length, outSalt->buffer);
 
     return err;
 }
 
+void Crypto_PufLock(void)
+{
+    xSemaphoreTake(pufMutex, portMAX_DELAY);
+}
+
+void Crypto_PufUnlock(void)
+{
+    xSemaphoreGive(pufMutex);
+}
+
 ErrorCode Crypto_GetPuf(Buffer *outPuf)
 {
     bool puf_ok = false;
 
+    Crypto_PufLock();
     do
     {
         clean_puf_response();
+        Stats_Increment(STAT_PUF_ATTEMPTS);
         puf_ok = get_puf_response();
+        if (!puf_ok)
+            Stats_Increment(STAT_PUF_FAILURES);
     } while (!puf_ok);
 
     if (PUF_STATE == RESPONSE_READY)
@@ -73,6 +154,36 @@ ErrorCode Crypto_GetPuf(Buffer *outPuf)
     }
 
     clean_puf_response();
+    Crypto_PufUnlock();
+    return SUCCESS;
+}
+
+ErrorCode Crypto_DeriveDeviceKey(const char *label, uint8_t *outKey, size_t length)
+{
+    uint8_t key[PUF_LENGTH];
+    if (length > sizeof(key))
+        return FAILURE;
+
+    uint8_t pufBuf[PUF_LENGTH] = {0};
+    Buffer puf = {.buffer = pufBuf, .length = sizeof(pufBuf)};
+    ErrorCode err = Crypto_GetPuf(&puf);
+    ERROR_CHECK(err);
+
+    /* an unavailable response leaves the buffer zeroed, never derive from it */
+    static const uint8_t zero[PUF_LENGTH] = {0};
+    int ret = -1;
+    if (memcmp(pufBuf, zero, sizeof(pufBuf)) != 0)
+        ret = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), pufBuf, sizeof(pufBuf),
+                              (const unsigned char *)label, strlen(label), key);
+    mbedtls_platform_zeroize(pufBuf, sizeof(pufBuf));
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "device key derivation failed");
+        return FAILURE;
+    }
+
+    memcpy(outKey, key, length);
+    mbedtls_platform_zeroize(key, sizeof(key));
     return SUCCESS;
 }
 
@@ -97,6 +208,7 @@ ErrorCode Crypto_GenerateECCKey(mbedtls_pk_context *outputKey, Buffer puf, Buffe
 
     /* seed hmac drbg */
     err = mbedtls_hmac_drbg_seed_buf(&hmac_drbg, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), seed, seedLength);
+    free(seed);
     ERROR_CHECK(err);
 
     /* generate ecc key */
@@ -130,23 +242,98 @@ ErrorCode Crypto_GenerateCSR(mbedtls_pk_context *eccKey, CString certSubject, Bu
     /* set certificate private key */
     mbedtls_x509write_csr_set_key(&signing_req, eccKey);
 
-    /* rng */
-    mbedtls_ctr_drbg_context ctrDrbg;
-    mbedtls_entropy_context entropy;
-    mbedtls_ctr_drbg_init(&ctrDrbg);
-    mbedtls_entropy_init(&entropy);
+    /* get csr der, written at the end of the buffer */
+    int length = mbedtls_x509write_csr_der(&signing_req, outCsr->buffer, outCsr->length, Crypto_Random, NULL);
+    mbedtls_x509write_csr_free(&signing_req);
 
-    err = Crypto_SeedCtrDrbg(&ctrDrbg, &entropy);
-    ERROR_CHECK(err);
+    if (length < 0)
+        return length;
 
-    /* get crs pem */
-    err = mbedtls_x509write_csr_pem(&signing_req, outCsr->buffer, outCsr->length, mbedtls_ctr_drbg_random, &ctrDrbg);
+    memmove(outCsr->buffer, outCsr->buffer + outCsr->length - length, length);
+    outCsr->length = length;
 
-    mbedtls_x509write_csr_free(&signing_req);
-    mbedtls_ctr_drbg_free(&ctrDrbg);
-    mbedtls_entropy_free(&entropy);
+    return SUCCESS;
+}
 
-    return err;
+static const struct
+{
+    const char *header;
+    const char *footer;
+} pemLabels[] = {
+    [CRYPTO_PEM_CERTIFICATE] = {.header = "-----BEGIN CERTIFICATE-----\n", .footer = "-----END CERTIFICATE-----\n"},
+    [CRYPTO_PEM_CSR] = {.header = "-----BEGIN CERTIFICATE REQUEST-----\n", .footer = "-----END CERTIFICATE REQUEST-----\n"},
+};
+
+bool Crypto_IsPem(CBuffer data)
+{
+    const char *prefix = "-----BEGIN ";
+    return data.length > strlen(prefix) && memcmp(data.buffer, prefix, strlen(prefix)) == 0;
+}
+
+ErrorCode Crypto_PemToDer(CryptoPemType type, CBuffer pem, Buffer *outDer)
+{
+    /* pem parser needs a null terminated string */
+    char *pemStr = (char *)calloc(pem.length + 1, sizeof(char));
+    if (!pemStr)
+        return FAILURE;
+    memcpy(pemStr, pem.buffer, pem.length);
+
+    /* match labels without the trailing newline to accept both \n and \r\n */
+    char header[40] = {0};
+    char footer[40] = {0};
+    snprintf(header, sizeof(header), "%.*s", (int)strlen(pemLabels[type].header) - 1, pemLabels[type].header);
+    snprintf(footer, sizeof(footer), "%.*s", (int)strlen(pemLabels[type].footer) - 1, pemLabels[type].footer);
+
+    mbedtls_pem_context pemCtx;
+    mbedtls_pem_init(&pemCtx);
+
+    size_t usedLength = 0;
+    int err = mbedtls_pem_read_buffer(&pemCtx, header, footer, (const unsigned char *)pemStr, NULL, 0, &usedLength);
+    free(pemStr);
+
+    if (err)
+    {
+        ESP_LOGE(TAG, "failed to decode pem: -0x%04X", -err);
+        mbedtls_pem_free(&pemCtx);
+        return FAILURE;
+    }
+
+    outDer->buffer = (uint8_t *)malloc(pemCtx.buflen);
+    if (!outDer->buffer)
+    {
+        mbedtls_pem_free(&pemCtx);
+        return FAILURE;
+    }
+
+    memcpy(outDer->buffer, pemCtx.buf, pemCtx.buflen);
+    outDer->length = pemCtx.buflen;
+    mbedtls_pem_free(&pemCtx);
+
+    return SUCCESS;
+}
+
+ErrorCode Crypto_DerToPem(CryptoPemType type, CBuffer der, Buffer *outPem)
+{
+    /* get required length, including the null terminator */
+    size_t pemLength = 0;
+    mbedtls_pem_write_buffer(pemLabels[type].header, pemLabels[type].footer, der.buffer, der.length, NULL, 0, &pemLength);
+
+    outPem->buffer = (uint8_t *)calloc(pemLength, sizeof(uint8_t));
+    if (!outPem->buffer)
+        return FAILURE;
+
+    int err = mbedtls_pem_write_buffer(pemLabels[type].header, pemLabels[type].footer, der.buffer, der.length, outPem->buffer, pemLength, &pemLength);
+    if (err)
+    {
+        ESP_LOGE(TAG, "failed to encode pem: -0x%04X", -err);
+        free(outPem->buffer);
+        outPem->buffer = NULL;
+        return FAILURE;
+    }
+
+    outPem->length = pemLength - 1;
+
+    return SUCCESS;
 }
 
 ErrorCode Crypto_RefreshCertificate(Buffer *outCsr)
@@ -182,7 +369,7 @@ ErrorCode Crypto_RefreshCertificate(Buffer *outCsr)
     err = Crypto_GenerateECCKey(&eccPkCtx, puf, salt);
     ERROR_CHECK(err);
 
-    /* generate certificate signing request*/
+    /* generate certificate signing request (der) */
     uint8_t *csrBuf = (uint8_t *)calloc(CSR_BUF_MAX_LEN, sizeof(uint8_t));
     memset(csrBuf, 0, CSR_BUF_MAX_LEN);
     outCsr->buffer = csrBuf;
@@ -202,6 +389,7 @@ ErrorCode Crypto_RefreshCertificate(Buffer *outCsr)
 ErrorCode Crypto_GetECCKey(mbedtls_pk_context *eccKey)
 {
     ErrorCode err = SUCCESS;
+    TraceSpan span = TRACE_BEGIN("get_ecc_key");
 
     Buffer salt;
     bool findSalt = Nvs_GetBuffer(Core_GetSaltNvsKey(), &salt);
@@ -220,6 +408,7 @@ ErrorCode Crypto_GetECCKey(mbedtls_pk_context *eccKey)
     err = Crypto_GenerateECCKey(eccKey, puf, salt);
 
     free(salt.buffer);
+    TRACE_END(span);
 
     return err;
 }
\ No newline at end of file
@@ -4,7 +4,26 @@
 #include "core/error.h"
 #include "define.h"
 
+#include <stdbool.h>
+
+typedef enum CryptoPemType
+{
+    CRYPTO_PEM_CERTIFICATE,
+    CRYPTO_PEM_CSR,
+} CryptoPemType;
+
+ErrorCode Crypto_Init(void);
+int Crypto_Random(void *ctx, unsigned char *output, size_t length);
 ErrorCode Crypto_GetECCKey(mbedtls_pk_context *eccKey);
 ErrorCode Crypto_RefreshCertificate(Buffer *outCsr);
 ErrorCode Crypto_GetRandomSalt(Buffer *outSalt);
-ErrorCode Crypto_GetPuf(Buffer *outPuf);
\ No newline at end of file
+ErrorCode Crypto_GetPuf(Buffer *outPuf);
+/* key bound to this device: HMAC-SHA256 of label keyed with the PUF response */
+ErrorCode Crypto_DeriveDeviceKey(const char *label, uint8_t *outKey, size_t length);
+ErrorCode Crypto_GenerateECCKey(mbedtls_pk_context *outputKey, Buffer puf, Buffer salt);
+ErrorCode Crypto_GenerateCSR(mbedtls_pk_context *eccKey, CString certSubject, Buffer *outCsr);
+void Crypto_PufLock(void);
+void Crypto_PufUnlock(void);
+bool Crypto_IsPem(CBuffer data);
+ErrorCode Crypto_PemToDer(CryptoPemType type, CBuffer pem, Buffer *outDer);
+ErrorCode Crypto_DerToPem(CryptoPemType type, CBuffer der, Buffer *outPem);
\ No newline at end of file
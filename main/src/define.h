@@ -14,10 +14,15 @@
 #define CRT_ACK_TOPIC "management/esp32-cris/crt_ack"
 #define CRT_ERR_TOPIC "management/esp32-cris/crt_err"
 
+/* appended to a topic whose payload is cbor instead of json */
+#define CBOR_TOPIC_SUFFIX "/cbor"
+
 // TLS CERT
 #define CERT_ORGANIZATION "UNIVR"
 #define DEVICE_ID "esp32-cris"
-#define MGT_TOPIC_FILTER "management/esp32-cris/+"
+#define MGT_TOPIC_FILTER "management/esp32-cris/#"
+#define TELEMETRY_TOPIC "esp32-cris/telemetry"
+#define METRICS_TOPIC "esp32-cris/metrics"
 
 // NVS Keys
 #define NVS_DEVICE_CERT_KEY "tls-crt"
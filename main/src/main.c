@@ -5,16 +5,21 @@
 #include "esp_sleep.h" // esp_default_wake_deep_sleep
 
 #include "core/core.h" // Core_TaskStart
+#include "core/trace.h"
 
 #include "puf_sec.h"
 
 #include "crypto/crypto.h"
+#include "net/tls_memory.h"
 
 void app_main(void)
 {
+    TraceSpan pufSpan = TRACE_BEGIN("puflib_init");
     puflib_init();
+    TRACE_END(pufSpan);
 
     /* initialization */
+    TraceSpan nvsSpan = TRACE_BEGIN("nvs_init");
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
@@ -22,9 +27,16 @@ void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    TRACE_END(nvsSpan);
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
+    /* install the tls allocator before any mbedtls allocation, it only budgets the mqtt transport */
+    ESP_ERROR_CHECK(TLSMemory_Init());
+    TraceSpan cryptoSpan = TRACE_BEGIN("crypto_init");
+    ESP_ERROR_CHECK(Crypto_Init());
+    TRACE_END(cryptoSpan);
+
     /* start main task */
     Core_TaskStart();
 }
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <string.h>
 #include <sys/param.h>
 #include <stdlib.h>
@@ -10,20 +11,73 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_http_client.h"
 
 #include "net/http_client.h"
 
-#define MAX_HTTP_RECV_BUFFER 512
-#define MAX_HTTP_OUTPUT_BUFFER 2048
+#define HTTP_TASK_STACK_SIZE 4096
+
+/* bytes of the server reply kept for the log */
+#define HTTP_RESPONSE_LOG_SIZE 64
+
+/* a failed first read faster than this is the eof of a connection closed while idle */
+#define HTTP_STALE_READ_MAX_US 200000
 
 static const char *TAG = "HttpClient";
 
-esp_err_t _http_event_handler(esp_http_client_event_t *evt)
+typedef struct HttpRequest
+{
+    size_t length;
+    char body[];
+} HttpRequest;
+
+/* per-request state handed to the event handler through user_data */
+typedef struct HttpExchange
+{
+    HttpResponseSink *sink;
+    bool isNewConnection; /* the connection was opened by this request, not reused */
+    esp_err_t err;
+    int64_t elapsedUs;
+} HttpExchange;
+
+static struct
+{
+    esp_http_client_handle_t client;
+    QueueHandle_t requests;
+} http = {0};
+
+static ErrorCode Http_SinkWrite(HttpResponseSink *sink, const uint8_t *data, size_t length)
+{
+    /* the client ignores the handler result, later data of a failed sink is dropped here */
+    if (sink->error)
+        return sink->error;
+
+    sink->length += length;
+
+    /* streamed bodies are never held in memory */
+    if (sink->onData)
+    {
+        sink->error = sink->onData(sink->ctx, data, length);
+        return sink->error;
+    }
+
+    /* keep what fits, the rest is counted but dropped */
+    size_t stored = sink->length - length;
+    if (stored < sink->size)
+        memcpy(sink->buffer + stored, data, MIN(length, sink->size - stored));
+
+    return SUCCESS;
+}
+
+/* state of a request lives in the exchange passed as user_data, several clients can run at once */
+static esp_err_t Http_EventHandler(esp_http_client_event_t *evt)
 {
-    static char *output_buffer; // Buffer to store response of http request from event handler
-    static int output_len;      // Stores number of bytes read
+    HttpExchange *exchange = (HttpExchange *)evt->user_data;
+    HttpResponseSink *sink = exchange ? exchange->sink : NULL;
+
     switch (evt->event_id)
     {
     case HTTP_EVENT_ERROR:
@@ -31,6 +85,8 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
         break;
     case HTTP_EVENT_ON_CONNECTED:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+        if (exchange)
+            exchange->isNewConnection = true;
         break;
     case HTTP_EVENT_HEADER_SENT:
         ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
@@ -39,56 +95,13 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
         ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
         break;
     case HTTP_EVENT_ON_DATA:
+        /* chunked bodies arrive here already decoded, one event per piece */
         ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-        /*
-         *  Check for chunked encoding is added as the URL for chunked encoding used in this example returns binary data.
-         *  However, event handler can also be used in case chunked encoding is used.
-         */
-        if (!esp_http_client_is_chunked_response(evt->client))
-        {
-            // If user_data buffer is configured, copy the response into the buffer
-            int copy_len = 0;
-            if (evt->user_data)
-            {
-                copy_len = MIN(evt->data_len, (MAX_HTTP_OUTPUT_BUFFER - output_len));
-                if (copy_len)
-                {
-                    memcpy(evt->user_data + output_len, evt->data, copy_len);
-                }
-            }
-            else
-            {
-                const int buffer_len = esp_http_client_get_content_length(evt->client);
-                if (output_buffer == NULL)
-                {
-                    output_buffer = (char *)malloc(buffer_len);
-                    output_len = 0;
-                    if (output_buffer == NULL)
-                    {
-                        ESP_LOGE(TAG, "Failed to allocate memory for output buffer");
-                        return ESP_FAIL;
-                    }
-                }
-                copy_len = MIN(evt->data_len, (buffer_len - output_len));
-                if (copy_len)
-                {
-                    memcpy(output_buffer + output_len, evt->data, copy_len);
-                }
-            }
-            output_len += copy_len;
-        }
-
+        if (sink && Http_SinkWrite(sink, (const uint8_t *)evt->data, evt->data_len))
+            return ESP_FAIL;
         break;
     case HTTP_EVENT_ON_FINISH:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-        if (output_buffer != NULL)
-        {
-            // Response is accumulated in output_buffer. Uncomment the below line to print the accumulated response
-            // ESP_LOG_BUFFER_HEX(TAG, output_buffer, output_len);
-            free(output_buffer);
-            output_buffer = NULL;
-        }
-        output_len = 0;
         break;
     case HTTP_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
@@ -99,45 +112,173 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
             ESP_LOGI(TAG, "Last esp error code: 0x%x", err);
             ESP_LOGI(TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
         }
-        if (output_buffer != NULL)
-        {
-            free(output_buffer);
-            output_buffer = NULL;
-        }
-        output_len = 0;
         break;
     }
     return ESP_OK;
 }
 
-ErrorCode Http_SendResponse(const char *response)
+esp_http_client_handle_t Http_InitClient(esp_http_client_config_t *config)
+{
+    config->event_handler = Http_EventHandler;
+    return esp_http_client_init(config);
+}
+
+static ErrorCode Http_Exchange(esp_http_client_handle_t client, HttpResponseSink *sink, HttpExchange *exchange)
+{
+    if (sink)
+    {
+        sink->length = 0;
+        sink->error = SUCCESS;
+    }
+
+    *exchange = (HttpExchange){.sink = sink};
+
+    /* the exchange only belongs to this request */
+    int64_t startUs = esp_timer_get_time();
+    esp_http_client_set_user_data(client, exchange);
+    exchange->err = esp_http_client_perform(client);
+    esp_http_client_set_user_data(client, NULL);
+    exchange->elapsedUs = esp_timer_get_time() - startUs;
+
+    if (exchange->err != ESP_OK)
+    {
+        ESP_LOGD(TAG, "perform failed: %s", esp_err_to_name(exchange->err));
+        return FAILURE;
+    }
+
+    /* the body was not handled, do not leave the connection open for the next request */
+    if (sink && sink->error)
+    {
+        ESP_LOGW(TAG, "response sink failed after %u bytes", sink->length);
+        esp_http_client_close(client);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+ErrorCode Http_Perform(esp_http_client_handle_t client, HttpResponseSink *sink)
+{
+    HttpExchange exchange;
+    return Http_Exchange(client, sink, &exchange);
+}
+
+static bool Http_IsStaleConnection(const HttpExchange *exchange)
+{
+    /* a fresh connection that fails is a real failure */
+    if (exchange->isNewConnection)
+        return false;
+
+    /* the request did not get out, the server cannot have acted on it */
+    if (exchange->err == ESP_ERR_HTTP_CONNECT || exchange->err == ESP_ERR_HTTP_WRITE_DATA)
+        return true;
+
+    /* a peer that closed the idle socket answers the first read with an immediate eof,
+       a slow read may come after the server took the request and must not be replayed */
+    return exchange->err == ESP_ERR_HTTP_FETCH_HEADER && exchange->elapsedUs < HTTP_STALE_READ_MAX_US;
+}
+
+static ErrorCode Http_Post(HttpRequest *request, bool isReused)
+{
+    /* the reply is only logged, a short prefix is enough */
+    uint8_t replyBuf[HTTP_RESPONSE_LOG_SIZE];
+    HttpResponseSink reply = {.buffer = replyBuf, .size = sizeof(replyBuf)};
+
+    esp_http_client_set_post_field(http.client, request->body, request->length);
+
+    /* the post is not idempotent, it is only replayed when the kept-alive connection was already dead */
+    HttpExchange exchange;
+    ErrorCode err = Http_Exchange(http.client, &reply, &exchange);
+    if (err && isReused && Http_IsStaleConnection(&exchange))
+    {
+        ESP_LOGW(TAG, "HTTP POST on a stale connection (%s), reconnecting", esp_err_to_name(exchange.err));
+        esp_http_client_close(http.client);
+        err = Http_Exchange(http.client, &reply, &exchange);
+    }
+
+    if (err)
+    {
+        ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(exchange.err));
+        esp_http_client_close(http.client);
+        return FAILURE;
+    }
+
+    ESP_LOGI(TAG, "HTTP POST Status = %d, %u bytes: %.*s", esp_http_client_get_status_code(http.client), reply.length,
+             (int)MIN(reply.length, reply.size), (const char *)reply.buffer);
+    return SUCCESS;
+}
+
+static void Http_TaskMain(void *pvParameters)
 {
     esp_http_client_config_t config = {
-        .host = "192.168.0.107",
-        .path = "/response",
-        .port = 3000,
-        .event_handler = _http_event_handler,
+        .host = HTTP_RESPONSE_HOST,
+        .path = HTTP_RESPONSE_PATH,
+        .port = HTTP_RESPONSE_PORT,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = HTTP_TIMEOUT_MS,
+        .keep_alive_enable = true,
     };
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    /* one client for the lifetime of the task, its connection is reused across requests */
+    http.client = Http_InitClient(&config);
+    assert(http.client);
+    esp_http_client_set_header(http.client, "Content-Type", "application/json");
 
-    char post_data[100] = {0};
-    snprintf(post_data, 100, "{\"response\":\"%s\"}", response);
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_post_field(client, post_data, strlen(post_data));
-    esp_err_t err = esp_http_client_perform(client);
-    if (err == ESP_OK)
+    bool isConnectionOpen = false;
+    while (true)
     {
-        ESP_LOGI(TAG, "HTTP POST Status = %d",
-                 esp_http_client_get_status_code(client));
+        HttpRequest *request;
+        if (xQueueReceive(http.requests, &request, pdMS_TO_TICKS(HTTP_IDLE_TIMEOUT_MS)) != pdTRUE)
+        {
+            /* give the socket back when no response was sent for a while */
+            if (isConnectionOpen)
+            {
+                ESP_LOGI(TAG, "closing idle connection");
+                esp_http_client_close(http.client);
+                isConnectionOpen = false;
+            }
+            continue;
+        }
+
+        /* a burst is drained back to back on the same connection */
+        isConnectionOpen = Http_Post(request, isConnectionOpen) == SUCCESS;
+        free(request);
     }
-    else
+}
+
+ErrorCode Http_Start(void)
+{
+    http.requests = xQueueCreate(HTTP_QUEUE_SIZE, sizeof(HttpRequest *));
+    if (!http.requests)
+        return FAILURE;
+
+    if (xTaskCreate(Http_TaskMain, "http_task", HTTP_TASK_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+        return FAILURE;
+
+    return SUCCESS;
+}
+
+ErrorCode Http_SendResponse(const char *response)
+{
+    if (!http.requests)
+        return FAILURE;
+
+    /* body follows the request in the same allocation */
+    int length = snprintf(NULL, 0, "{\"response\":\"%s\"}", response);
+    HttpRequest *request = malloc(sizeof(HttpRequest) + length + 1);
+    if (!request)
+        return FAILURE;
+
+    request->length = length;
+    snprintf(request->body, length + 1, "{\"response\":\"%s\"}", response);
+
+    /* never block the caller, the http task sends in order */
+    if (xQueueSend(http.requests, &request, 0) != pdTRUE)
     {
-        ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "request queue full, response dropped");
+        free(request);
+        return FAILURE;
     }
 
-    esp_http_client_cleanup(client);
-
-    return err;
-}
\ No newline at end of file
+    return SUCCESS;
+}
@@ -1,5 +1,37 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_http_client.h"
+
 #include "core/error.h"
 
-ErrorCode Http_SendResponse(const char *response);
\ No newline at end of file
+#define HTTP_RESPONSE_HOST CONFIG_HTTP_RESPONSE_HOST
+#define HTTP_RESPONSE_PORT CONFIG_HTTP_RESPONSE_PORT
+#define HTTP_RESPONSE_PATH CONFIG_HTTP_RESPONSE_PATH
+#define HTTP_TIMEOUT_MS CONFIG_HTTP_TIMEOUT_MS
+#define HTTP_IDLE_TIMEOUT_MS CONFIG_HTTP_IDLE_TIMEOUT_MS
+#define HTTP_QUEUE_SIZE CONFIG_HTTP_QUEUE_SIZE
+
+typedef ErrorCode (*HttpDataCallback)(void *ctx, const uint8_t *data, size_t length);
+
+/* destination of a response body, either a caller buffer or a streaming callback */
+typedef struct HttpResponseSink
+{
+    uint8_t *buffer; /* bodies longer than size are truncated */
+    size_t size;
+    HttpDataCallback onData; /* takes precedence over buffer, a failure aborts the request */
+    void *ctx;
+    size_t length;   /* body bytes received, set by Http_Perform */
+    ErrorCode error; /* first callback failure, no data is forwarded once set */
+} HttpResponseSink;
+
+/* installs the sink-aware event handler */
+esp_http_client_handle_t Http_InitClient(esp_http_client_config_t *config);
+/* performs a request on a client of Http_InitClient, the body goes to sink (may be NULL) */
+ErrorCode Http_Perform(esp_http_client_handle_t client, HttpResponseSink *sink);
+
+ErrorCode Http_Start(void);
+/* queues the response, it is posted by the http task over a kept-alive connection */
+ErrorCode Http_SendResponse(const char *response);
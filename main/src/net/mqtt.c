@@ -1,4 +1,6 @@
+#include <sys/param.h>
 #include <sys/time.h>
+#include <string.h>
 #include "core_mqtt.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
@@ -6,11 +8,15 @@
 
 #include "net/tls_transport.h"
 #include "net/mqtt.h"
+#include "core/rtc_store.h"
+#include "telemetry/stats.h"
 #include "define.h"
 
 static const char *TAG = "MQTT";
 
 static void Mqtt_Callback(struct MQTTContext *pContext, struct MQTTPacketInfo *pPacketInfo, struct MQTTDeserializedInfo *pDeserializedInfo);
+static void Mqtt_FlushQueue(void);
+static void Mqtt_RequeueInflight(void);
 
 static uint8_t mqtt_buffer[MQTT_BUFFER_SIZE];
 
@@ -22,6 +28,78 @@ static MQTTFixedBuffer_t mqtt_fixedBuffer = {
 static TransportInterface_t mqtt_transportInterface;
 static MQTTContext_t mqtt_ctx = {0};
 static MqttCallback mqtt_callback;
+static CString mqtt_clientId;
+
+/* handlers receiving publish payloads as fragments */
+static struct
+{
+    char topic[MQTT_STREAM_TOPIC_MAX_LEN];
+    size_t topicLength;
+    MqttStreamCallback callback;
+} mqtt_streamHandlers[MQTT_MAX_STREAM_HANDLERS];
+static size_t mqtt_streamHandlersCount = 0;
+
+/* incoming packet framing, reads never cross a packet boundary */
+static struct
+{
+    uint8_t header[5];
+    size_t headerLength;
+    size_t headerServed;
+    size_t remainingLength;
+    bool isHeaderComplete;
+} mqtt_rx = {0};
+
+static uint8_t mqtt_streamChunk[MQTT_STREAM_CHUNK_SIZE];
+
+/* coreMQTT state records for QoS1 publishes */
+static MQTTPubAckInfo_t mqtt_outgoingRecords[MQTT_INFLIGHT_WINDOW];
+static MQTTPubAckInfo_t mqtt_incomingRecords[MQTT_INFLIGHT_WINDOW];
+
+typedef enum MqttQueueState
+{
+    MQTT_QUEUE_FREE = 0,
+    MQTT_QUEUE_PENDING,
+    MQTT_QUEUE_INFLIGHT,
+} MqttQueueState;
+
+/* QoS1 publishes waiting for transmission or acknowledgement */
+typedef struct MqttQueueEntry
+{
+    MqttQueueState state;
+    uint32_t sequence;
+    uint16_t packetId;
+    uint32_t sentAtMs;
+    uint8_t *data; /* topic followed by payload */
+    size_t topicLength;
+    size_t payloadLength;
+} MqttQueueEntry;
+
+static struct
+{
+    MqttQueueEntry entries[MQTT_PUBLISH_QUEUE_SIZE];
+    uint32_t nextSequence;
+    size_t inflightCount;
+} mqtt_queue = {0};
+
+/* session metadata kept in rtc slow memory across deep sleep */
+#define RTC_MQTT_MAGIC 0x4d515431 // MQT1
+
+static RTC_DATA_ATTR struct
+{
+    RtcStoreHeader header;
+    uint16_t nextPacketId;
+} mqtt_rtcState;
+
+static uint16_t Mqtt_GetPacketId(void)
+{
+    uint16_t packetId = MQTT_GetPacketId(&mqtt_ctx);
+
+    /* packet ids keep increasing after a wake up from deep sleep */
+    mqtt_rtcState.nextPacketId = mqtt_ctx.nextPacketId;
+    RtcStore_Seal(&mqtt_rtcState.header, RTC_MQTT_MAGIC, &mqtt_rtcState.nextPacketId, sizeof(mqtt_rtcState.nextPacketId));
+
+    return packetId;
+}
 
 static uint32_t Mqtt_GetTimeMsFunction()
 {
@@ -35,20 +113,245 @@ bool Mqtt_IsConnected(void)
     return mqtt_ctx.connectStatus == MQTTConnected;
 }
 
-ErrorCode Mqtt_ProcessLoop(void)
+static void Mqtt_ResetReceive(void)
+{
+    memset(&mqtt_rx, 0, sizeof(mqtt_rx));
+}
+
+static MqttStreamCallback Mqtt_FindStreamHandler(CString topic)
+{
+    for (size_t i = 0; i < mqtt_streamHandlersCount; i++)
+    {
+        if (mqtt_streamHandlers[i].topicLength == topic.length && memcmp(mqtt_streamHandlers[i].topic, topic.string, topic.length) == 0)
+            return mqtt_streamHandlers[i].callback;
+    }
+
+    return NULL;
+}
+
+static bool Mqtt_IsOversizedPublish(void)
+{
+    size_t packetLength = mqtt_rx.headerLength + mqtt_rx.remainingLength;
+    return (mqtt_rx.header[0] & 0xF0) == MQTT_PACKET_TYPE_PUBLISH && packetLength > sizeof(mqtt_buffer);
+}
+
+static int32_t Mqtt_ReadFixedHeader(struct NetworkContext *ctx)
+{
+    /* type byte followed by up to 4 bytes of remaining length */
+    while (!mqtt_rx.isHeaderComplete)
+    {
+        int32_t result = TLSTransport_Recv(ctx, &mqtt_rx.header[mqtt_rx.headerLength], 1);
+        if (result <= 0)
+            return result;
+
+        mqtt_rx.headerLength++;
+
+        if (mqtt_rx.headerLength == 1)
+            continue;
+
+        uint8_t encoded = mqtt_rx.header[mqtt_rx.headerLength - 1];
+        mqtt_rx.remainingLength += (size_t)(encoded & 0x7F) << (7 * (mqtt_rx.headerLength - 2));
+
+        if ((encoded & 0x80) == 0)
+            mqtt_rx.isHeaderComplete = true;
+        else if (mqtt_rx.headerLength == sizeof(mqtt_rx.header))
+            return -1;
+    }
+
+    return mqtt_rx.headerLength;
+}
+
+static int32_t Mqtt_TransportRecv(struct NetworkContext *ctx, void *pBuffer, size_t bytesToRecv)
+{
+    if (!mqtt_rx.isHeaderComplete)
+    {
+        int32_t result = Mqtt_ReadFixedHeader(ctx);
+        if (result <= 0)
+            return result;
+
+        /* leave oversized publishes to the streaming path */
+        if (Mqtt_IsOversizedPublish())
+            return 0;
+    }
+
+    /* serve the buffered fixed header first */
+    if (mqtt_rx.headerServed < mqtt_rx.headerLength)
+    {
+        size_t length = MIN(bytesToRecv, mqtt_rx.headerLength - mqtt_rx.headerServed);
+        memcpy(pBuffer, &mqtt_rx.header[mqtt_rx.headerServed], length);
+        mqtt_rx.headerServed += length;
+
+        if (mqtt_rx.headerServed == mqtt_rx.headerLength && mqtt_rx.remainingLength == 0)
+            Mqtt_ResetReceive();
+
+        return length;
+    }
+
+    /* never read past the end of the current packet */
+    int32_t result = TLSTransport_Recv(ctx, pBuffer, MIN(bytesToRecv, mqtt_rx.remainingLength));
+    if (result > 0)
+    {
+        mqtt_rx.remainingLength -= result;
+        if (mqtt_rx.remainingLength == 0)
+            Mqtt_ResetReceive();
+    }
+
+    return result;
+}
+
+static ErrorCode Mqtt_RecvExact(uint8_t *buffer, size_t length)
 {
-    ESP_LOGI(TAG, "process MQTT Loop");
+    struct NetworkContext *ctx = mqtt_transportInterface.pNetworkContext;
+    uint32_t start = Mqtt_GetTimeMsFunction();
+    size_t received = 0;
+
+    while (received < length)
+    {
+        int32_t result = TLSTransport_Recv(ctx, buffer + received, length - received);
+        if (result < 0)
+            return FAILURE;
+
+        received += result;
+
+        if (result == 0 && Mqtt_GetTimeMsFunction() - start > MQTT_STREAM_RECV_TIMEOUT_MS)
+            return FAILURE;
+    }
+
+    mqtt_rx.remainingLength -= length;
+    return SUCCESS;
+}
+
+static ErrorCode Mqtt_StreamPublish(void)
+{
+    uint8_t flags = mqtt_rx.header[0] & 0x0F;
+    uint8_t qos = (flags >> 1) & 0x03;
+
+    /* variable header: topic name and packet identifier */
+    uint8_t lengthBytes[2];
+    if (Mqtt_RecvExact(lengthBytes, sizeof(lengthBytes)))
+        return FAILURE;
+
+    size_t topicLength = (lengthBytes[0] << 8) | lengthBytes[1];
+    char topicBuf[MQTT_STREAM_TOPIC_MAX_LEN];
+    if (topicLength > sizeof(topicBuf) || Mqtt_RecvExact((uint8_t *)topicBuf, topicLength))
+        return FAILURE;
+
+    uint16_t packetId = 0;
+    if (qos > 0)
+    {
+        uint8_t idBytes[2];
+        if (Mqtt_RecvExact(idBytes, sizeof(idBytes)))
+            return FAILURE;
+        packetId = (idBytes[0] << 8) | idBytes[1];
+    }
+
+    CString topic = {.string = topicBuf, .length = topicLength};
+    size_t payloadLength = mqtt_rx.remainingLength;
+    MqttStreamCallback handler = Mqtt_FindStreamHandler(topic);
+
+    ESP_LOGI(TAG, "cloud: streaming publish [packetId=%u, topic=%.*s, payload=%u]", packetId, (int)topic.length, topic.string, payloadLength);
+    if (!handler)
+        ESP_LOGW(TAG, "no stream handler for %.*s, payload discarded", (int)topic.length, topic.string);
+
+    /* hand payload to the handler as it arrives */
+    size_t offset = 0;
+    while (offset < payloadLength)
+    {
+        size_t chunkLength = MIN(sizeof(mqtt_streamChunk), payloadLength - offset);
+        if (Mqtt_RecvExact(mqtt_streamChunk, chunkLength))
+            return FAILURE;
+
+        if (handler)
+            handler(topic, (CBuffer){.buffer = mqtt_streamChunk, .length = chunkLength}, offset, payloadLength);
+
+        offset += chunkLength;
+    }
+
+    Mqtt_ResetReceive();
+
+    if (qos == 1)
+    {
+        /* acknowledge as coreMQTT would */
+        uint8_t puback[4] = {MQTT_PACKET_TYPE_PUBACK, 2, packetId >> 8, packetId & 0xFF};
+        if (TLSTransport_Send(mqtt_transportInterface.pNetworkContext, puback, sizeof(puback)) != sizeof(puback))
+            return FAILURE;
+    }
+    else if (qos == 2)
+    {
+        ESP_LOGW(TAG, "QoS2 not supported on streamed publishes");
+    }
+
+    return SUCCESS;
+}
+
+ErrorCode Mqtt_RegisterStreamHandler(CString topic, MqttStreamCallback callback)
+{
+    if (mqtt_streamHandlersCount >= MQTT_MAX_STREAM_HANDLERS || topic.length > MQTT_STREAM_TOPIC_MAX_LEN)
+        return FAILURE;
+
+    memcpy(mqtt_streamHandlers[mqtt_streamHandlersCount].topic, topic.string, topic.length);
+    mqtt_streamHandlers[mqtt_streamHandlersCount].topicLength = topic.length;
+    mqtt_streamHandlers[mqtt_streamHandlersCount].callback = callback;
+    mqtt_streamHandlersCount++;
+
+    return SUCCESS;
+}
+
+static ErrorCode Mqtt_ProcessPacket(void)
+{
+    struct NetworkContext *ctx = mqtt_transportInterface.pNetworkContext;
+
+    /* driven by readiness, reads do not wait for more data */
+    TLSTransport_SetRecvWait(ctx, 0);
     MQTTStatus_t status = MQTT_ProcessLoop(&mqtt_ctx);
+    TLSTransport_SetRecvWait(ctx, MQTT_PROCESS_LOOP_TIMEOUT_MS);
 
-    if (status != MQTTSuccess)
+    /* the rest of the packet comes with a later readiness */
+    if (status != MQTTSuccess && status != MQTTNeedMoreBytes)
     {
         ESP_LOGE(TAG, "MQTT process loop failed: %s", MQTT_Status_strerror(status));
-        return ESP_FAIL;
+        return status == MQTTKeepAliveTimeout ? ESP_ERR_TIMEOUT : FAILURE;
     }
 
+    /* coreMQTT left a publish larger than its buffer pending */
+    if (mqtt_rx.isHeaderComplete && Mqtt_IsOversizedPublish())
+    {
+        ErrorCode err = Mqtt_StreamPublish();
+        Mqtt_ResetReceive();
+
+        if (err)
+        {
+            ESP_LOGE(TAG, "MQTT streaming receive failed");
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+ErrorCode Mqtt_ProcessLoop(void)
+{
+    ESP_LOGD(TAG, "process MQTT Loop");
+
+    /* packets already decrypted by TLS do not make the socket readable again */
+    size_t packets = 0;
+    do
+    {
+        ERROR_CHECK(Mqtt_ProcessPacket());
+        packets++;
+    } while (packets < MQTT_MAX_PACKETS_PER_LOOP && TLSTransport_HasPendingData(mqtt_transportInterface.pNetworkContext));
+
+    /* send anything left over by a failed or window limited publish */
+    Mqtt_FlushQueue();
+
     return SUCCESS;
 }
 
+bool Mqtt_HasPendingData(void)
+{
+    return TLSTransport_HasPendingData(mqtt_transportInterface.pNetworkContext);
+}
+
 ErrorCode Mqtt_Init(MqttCallback callback)
 {
     mqtt_callback = callback;
@@ -59,7 +362,7 @@ ErrorCode Mqtt_Init(MqttCallback callback)
     mqtt_transportInterface.pNetworkContext = TLSTransport_Init(hostname, port, MQTT_PROCESS_LOOP_TIMEOUT_MS, "NONE", "NONE", "NONE");
 
     mqtt_transportInterface.send = TLSTransport_Send;
-    mqtt_transportInterface.recv = TLSTransport_Recv;
+    mqtt_transportInterface.recv = Mqtt_TransportRecv;
 
     /* initialize MQTT library */
     MQTTStatus_t status = MQTT_Init(&mqtt_ctx, &mqtt_transportInterface, Mqtt_GetTimeMsFunction, Mqtt_Callback, &mqtt_fixedBuffer);
@@ -69,22 +372,37 @@ ErrorCode Mqtt_Init(MqttCallback callback)
         return FAILURE;
     }
 
+    status = MQTT_InitStatefulQoS(&mqtt_ctx, mqtt_outgoingRecords, MQTT_INFLIGHT_WINDOW, mqtt_incomingRecords, MQTT_INFLIGHT_WINDOW);
+    if (status != MQTTSuccess)
+    {
+        ESP_LOGE(TAG, "QoS init failed: %s", MQTT_Status_strerror(status));
+        return FAILURE;
+    }
+
+    if (RtcStore_Verify(&mqtt_rtcState.header, RTC_MQTT_MAGIC, &mqtt_rtcState.nextPacketId, sizeof(mqtt_rtcState.nextPacketId)) && mqtt_rtcState.nextPacketId != 0)
+    {
+        ESP_LOGI(TAG, "restored session metadata from rtc memory");
+        mqtt_ctx.nextPacketId = mqtt_rtcState.nextPacketId;
+    }
+
     return SUCCESS;
 }
 
-ErrorCode Mqtt_Connect(CString clientId, bool *sessionPresent, int retry)
+ErrorCode Mqtt_ConnectStart(CString clientId)
 {
     ESP_LOGI(TAG, "connecting to broker...");
 
-    ErrorCode err = TLSTransport_Connect(mqtt_transportInterface.pNetworkContext);
-    if (err && !retry)
-    {
-        return FAILURE;
-    }
+    mqtt_clientId = clientId;
+    Mqtt_ResetReceive();
+
+    return TLSTransport_ConnectStart(mqtt_transportInterface.pNetworkContext);
+}
 
+static ErrorCode Mqtt_SessionConnect(bool *sessionPresent)
+{
     MQTTConnectInfo_t connectInfo = {
-        .pClientIdentifier = clientId.string,
-        .clientIdentifierLength = (uint16_t)clientId.length,
+        .pClientIdentifier = mqtt_clientId.string,
+        .clientIdentifierLength = (uint16_t)mqtt_clientId.length,
         .cleanSession = MQTT_ALWAYS_START_CLEAN_SESSION,
         .keepAliveSeconds = MQTT_KEEPALIVE_SECONDS,
         .pUserName = NULL,
@@ -98,12 +416,6 @@ ErrorCode Mqtt_Connect(CString clientId, bool *sessionPresent, int retry)
     if (status != MQTTSuccess)
     {
         ESP_LOGE(TAG, "MQTT connection failed: %s", MQTT_Status_strerror(status));
-        if (retry > 0)
-        {
-            Mqtt_Disconnect(true);
-            vTaskDelay(500 / portTICK_PERIOD_MS); // wait till sram really turns on and stabilizes (not necessary?)
-            return Mqtt_Connect(clientId, sessionPresent, retry - 1);
-        }
         return FAILURE;
     }
 
@@ -111,6 +423,40 @@ ErrorCode Mqtt_Connect(CString clientId, bool *sessionPresent, int retry)
     return SUCCESS;
 }
 
+MqttConnectStatus Mqtt_ConnectStep(bool *sessionPresent, uint32_t waitMs)
+{
+    TLSConnectStatus status = TLSTransport_ConnectStep(mqtt_transportInterface.pNetworkContext, waitMs);
+
+    if (status == TLS_CONNECT_IN_PROGRESS)
+        return MQTT_CONNECTION_IN_PROGRESS;
+
+    if (status == TLS_CONNECT_FAILED)
+        return MQTT_CONNECTION_FAILED;
+
+    /* transport is ready, open the mqtt session */
+    if (Mqtt_SessionConnect(sessionPresent))
+    {
+        Mqtt_Disconnect(true);
+        return MQTT_CONNECTION_FAILED;
+    }
+
+    /* retransmit publishes that were not acknowledged before the connection dropped */
+    Mqtt_RequeueInflight();
+    Mqtt_FlushQueue();
+
+    return MQTT_CONNECTION_DONE;
+}
+
+TLSConnectPhase Mqtt_GetConnectPhase(void)
+{
+    return TLSTransport_GetConnectPhase(mqtt_transportInterface.pNetworkContext);
+}
+
+int Mqtt_GetSocket(void)
+{
+    return TLSTransport_GetSocket(mqtt_transportInterface.pNetworkContext);
+}
+
 ErrorCode Mqtt_Disconnect(bool force)
 {
     ESP_LOGI(TAG, "disconnecting from MQTT broker...");
@@ -124,41 +470,204 @@ ErrorCode Mqtt_Disconnect(bool force)
 
     ESP_LOGI(TAG, "closing TLS socket...");
     TLSTransport_Disconnect(mqtt_transportInterface.pNetworkContext, force);
+    Mqtt_ResetReceive();
     ESP_LOGI(TAG, "now disconnected from server");
     mqtt_ctx.connectStatus = MQTTNotConnected;
     return SUCCESS;
 }
 
-ErrorCode Mqtt_Publish(CString topic, CBuffer data)
+void Mqtt_InvalidateCredentials(void)
+{
+    TLSTransport_InvalidateCredentials(mqtt_transportInterface.pNetworkContext);
+}
+
+static MqttQueueEntry *Mqtt_NextPending(void)
+{
+    MqttQueueEntry *next = NULL;
+
+    for (size_t i = 0; i < MQTT_PUBLISH_QUEUE_SIZE; i++)
+    {
+        MqttQueueEntry *entry = &mqtt_queue.entries[i];
+        if (entry->state == MQTT_QUEUE_PENDING && (!next || (int32_t)(entry->sequence - next->sequence) < 0))
+            next = entry;
+    }
+
+    return next;
+}
+
+static void Mqtt_ReleaseEntry(MqttQueueEntry *entry)
+{
+    if (entry->state == MQTT_QUEUE_INFLIGHT)
+        mqtt_queue.inflightCount--;
+
+    free(entry->data);
+    memset(entry, 0, sizeof(MqttQueueEntry));
+}
+
+static ErrorCode Mqtt_SendEntry(MqttQueueEntry *entry)
+{
+    MQTTPublishInfo_t publishInfo = {
+        .pTopicName = (const char *)entry->data,
+        .topicNameLength = (uint16_t)entry->topicLength,
+        .qos = MQTTQoS1,
+        .pPayload = entry->data + entry->topicLength,
+        .payloadLength = entry->payloadLength,
+        .retain = false,
+        .dup = false,
+    };
+
+    if (entry->packetId == 0)
+        entry->packetId = Mqtt_GetPacketId();
+
+    MQTTStatus_t status = MQTT_Publish(&mqtt_ctx, &publishInfo, entry->packetId);
+    if (status != MQTTSuccess)
+    {
+        ESP_LOGE(TAG, "publish failure: %s", MQTT_Status_strerror(status));
+        return FAILURE;
+    }
+
+    entry->state = MQTT_QUEUE_INFLIGHT;
+    entry->sentAtMs = Mqtt_GetTimeMsFunction();
+    mqtt_queue.inflightCount++;
+
+    ESP_LOGI(TAG, "published packet %u (in flight: %u)", entry->packetId, mqtt_queue.inflightCount);
+    return SUCCESS;
+}
+
+static void Mqtt_FlushQueue(void)
+{
+    /* keep the window full, acknowledgements are handled in the callback */
+    while (Mqtt_IsConnected() && mqtt_queue.inflightCount < MQTT_INFLIGHT_WINDOW)
+    {
+        MqttQueueEntry *entry = Mqtt_NextPending();
+        if (!entry || Mqtt_SendEntry(entry))
+            return;
+    }
+}
+
+static void Mqtt_RequeueInflight(void)
+{
+    for (size_t i = 0; i < MQTT_PUBLISH_QUEUE_SIZE; i++)
+    {
+        MqttQueueEntry *entry = &mqtt_queue.entries[i];
+        if (entry->state != MQTT_QUEUE_INFLIGHT)
+            continue;
+
+        /* sessions always start clean, so the broker forgot the old id: send as a new publish */
+        entry->state = MQTT_QUEUE_PENDING;
+        entry->packetId = 0;
+        mqtt_queue.inflightCount--;
+    }
+}
+
+static void Mqtt_OnPubAck(uint16_t packetId)
+{
+    for (size_t i = 0; i < MQTT_PUBLISH_QUEUE_SIZE; i++)
+    {
+        MqttQueueEntry *entry = &mqtt_queue.entries[i];
+        if (entry->state == MQTT_QUEUE_INFLIGHT && entry->packetId == packetId)
+        {
+            ESP_LOGI(TAG, "packet %u acknowledged in %lu ms", packetId, (unsigned long)(Mqtt_GetTimeMsFunction() - entry->sentAtMs));
+            Mqtt_ReleaseEntry(entry);
+            return;
+        }
+    }
+
+    ESP_LOGW(TAG, "unexpected PUBACK for packet %u", packetId);
+}
+
+static ErrorCode Mqtt_Enqueue(CString topic, CBuffer data)
+{
+    MqttQueueEntry *entry = NULL;
+    for (size_t i = 0; i < MQTT_PUBLISH_QUEUE_SIZE && !entry; i++)
+    {
+        if (mqtt_queue.entries[i].state == MQTT_QUEUE_FREE)
+            entry = &mqtt_queue.entries[i];
+    }
+
+    if (!entry)
+    {
+        ESP_LOGE(TAG, "publish queue full, dropping message on %.*s", (int)topic.length, topic.string);
+        return FAILURE;
+    }
+
+    entry->data = (uint8_t *)malloc(topic.length + data.length);
+    if (!entry->data)
+        return FAILURE;
+
+    memcpy(entry->data, topic.string, topic.length);
+    memcpy(entry->data + topic.length, data.buffer, data.length);
+    entry->topicLength = topic.length;
+    entry->payloadLength = data.length;
+    entry->packetId = 0;
+    entry->sequence = mqtt_queue.nextSequence++;
+    entry->state = MQTT_QUEUE_PENDING;
+
+    return SUCCESS;
+}
+
+static ErrorCode Mqtt_CountPublish(ErrorCode err, CBuffer data)
+{
+    if (err)
+    {
+        Stats_Increment(STAT_PUBLISH_FAILURES);
+        return err;
+    }
+
+    Stats_Increment(STAT_PUBLISH_COUNT);
+    Stats_Add(STAT_PUBLISH_BYTES, data.length);
+    return err;
+}
+
+ErrorCode Mqtt_Publish(CString topic, CBuffer data, MqttQoS qos)
 {
     ESP_LOGI(TAG, "publish packet");
 
-    uint16_t packet_id = MQTT_GetPacketId(&mqtt_ctx);
+    if (qos == MQTT_QOS1)
+    {
+        /* sent as soon as the window allows, kept until acknowledged */
+        ErrorCode err = Mqtt_Enqueue(topic, data);
+        if (!err)
+            Mqtt_FlushQueue();
+        return Mqtt_CountPublish(err, data);
+    }
+
     MQTTPublishInfo_t publishInfo = {
         .pTopicName = topic.string,
         .topicNameLength = (uint16_t)topic.length,
-        .qos = MQTT_DEFAULT_QoS,
+        .qos = MQTTQoS0,
         .pPayload = data.buffer,
         .payloadLength = (uint16_t)data.length,
         .retain = false,
         .dup = false,
     };
 
-    MQTTStatus_t status = MQTT_Publish(&mqtt_ctx, &publishInfo, packet_id);
+    MQTTStatus_t status = MQTT_Publish(&mqtt_ctx, &publishInfo, 0);
     if (status != MQTTSuccess)
     {
         ESP_LOGE(TAG, "publish failure: %s", MQTT_Status_strerror(status));
-        return FAILURE;
+        return Mqtt_CountPublish(FAILURE, data);
     }
-    ESP_LOGI(TAG, "published packet %u", packet_id);
-    return SUCCESS;
+    ESP_LOGI(TAG, "published QoS0 packet");
+    return Mqtt_CountPublish(SUCCESS, data);
+}
+
+size_t Mqtt_GetPendingPublishCount(void)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < MQTT_PUBLISH_QUEUE_SIZE; i++)
+    {
+        if (mqtt_queue.entries[i].state != MQTT_QUEUE_FREE)
+            count++;
+    }
+    return count;
 }
 
 ErrorCode Mqtt_Subscribe(CString topicFilter)
 {
     ESP_LOGI(TAG, "subscribe to topic");
 
-    uint16_t packet_id = MQTT_GetPacketId(&mqtt_ctx);
+    uint16_t packet_id = Mqtt_GetPacketId();
 
     MQTTSubscribeInfo_t subscribeInfo = {
         .pTopicFilter = topicFilter.string,
@@ -187,6 +696,13 @@ static void Mqtt_Callback(struct MQTTContext *pContext, struct MQTTPacketInfo *p
         return;
     }
 
+    if (pPacketInfo->type == MQTT_PACKET_TYPE_PUBACK)
+    {
+        Mqtt_OnPubAck(pDeserializedInfo->packetIdentifier);
+        Mqtt_FlushQueue();
+        return;
+    }
+
     if ((pPacketInfo->type & 0xF0) != MQTT_PACKET_TYPE_PUBLISH)
     {
         ESP_LOGI(TAG, "callback received [type=%u, packetId=%u]",
@@ -217,5 +733,13 @@ static void Mqtt_Callback(struct MQTTContext *pContext, struct MQTTPacketInfo *p
         .buffer = pDeserializedInfo->pPublishInfo->pPayload,
     };
 
+    /* stream handlers see small publishes as a single fragment */
+    MqttStreamCallback streamHandler = Mqtt_FindStreamHandler(topic);
+    if (streamHandler)
+    {
+        streamHandler(topic, payload, 0, payload.length);
+        return;
+    }
+
     mqtt_callback(topic, payload);
 }
\ No newline at end of file
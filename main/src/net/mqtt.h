@@ -1,25 +1,58 @@
 #pragma once
 
 #include "core/error.h"
+#include "net/tls_transport.h"
 #include "define.h"
 
 #define MQTT_BUFFER_SIZE 2048
 #define MQTT_DEFAULT_QoS MQTTQoS0
 #define MQTT_KEEPALIVE_SECONDS 120
 #define MQTT_PROCESS_LOOP_TIMEOUT_MS 100
+#define MQTT_MAX_PACKETS_PER_LOOP 8
 #define MQTT_CONNECT_TIMEOUT_SECONDS 10000
 #define MQTT_ALWAYS_START_CLEAN_SESSION true
 
+/* QoS1 publish pipeline */
+#define MQTT_INFLIGHT_WINDOW CONFIG_MQTT_INFLIGHT_WINDOW
+#define MQTT_PUBLISH_QUEUE_SIZE CONFIG_MQTT_PUBLISH_QUEUE_SIZE
+
+/* publishes larger than MQTT_BUFFER_SIZE are streamed in chunks */
+#define MQTT_STREAM_CHUNK_SIZE 512
+#define MQTT_STREAM_TOPIC_MAX_LEN 128
+#define MQTT_STREAM_RECV_TIMEOUT_MS 5000
+#define MQTT_MAX_STREAM_HANDLERS 4
+
 /* time to wait between one failed connect attempt to the next */
 #define MQTT_CONNECT_FAILURE_INTERVAL_SEC 10
 
 typedef void (*MqttCallback)(CString topic, CBuffer payload);
+typedef void (*MqttStreamCallback)(CString topic, CBuffer fragment, size_t offset, size_t totalLength);
+
+typedef enum MqttQoS
+{
+    MQTT_QOS0 = 0,
+    MQTT_QOS1 = 1,
+} MqttQoS;
+
+typedef enum MqttConnectStatus
+{
+    MQTT_CONNECTION_IN_PROGRESS,
+    MQTT_CONNECTION_DONE,
+    MQTT_CONNECTION_FAILED,
+} MqttConnectStatus;
 
 ErrorCode Mqtt_Init(MqttCallback callback);
 ErrorCode Mqtt_ProcessLoop(void);
-ErrorCode Mqtt_Connect(CString clientId, bool *sessionPresent, int retry);
+ErrorCode Mqtt_ConnectStart(CString clientId);
+MqttConnectStatus Mqtt_ConnectStep(bool *sessionPresent, uint32_t waitMs);
+TLSConnectPhase Mqtt_GetConnectPhase(void);
+int Mqtt_GetSocket(void);
+bool Mqtt_HasPendingData(void);
 ErrorCode Mqtt_Disconnect(bool force);
-ErrorCode Mqtt_Publish(CString topic, CBuffer data);
+ErrorCode Mqtt_Publish(CString topic, CBuffer data, MqttQoS qos);
+size_t Mqtt_GetPendingPublishCount(void);
 ErrorCode Mqtt_Subscribe(CString topicFilter);
 ErrorCode Mqtt_Unsubscribe(CString topicFilter);
-bool Mqtt_IsConnected(void);
\ No newline at end of file
+ErrorCode Mqtt_RegisterStreamHandler(CString topic, MqttStreamCallback callback);
+bool Mqtt_IsConnected(void);
+void Mqtt_InvalidateCredentials(void);
\ No newline at end of file
@@ -0,0 +1,460 @@
+#include "net/net_task.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/select.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "core/core.h"
+#include "core/spsc_queue.h"
+#include "core/trace.h"
+#include "net/supervisor.h"
+#include "net/tls_memory.h"
+
+static const char *TAG = "NetTask";
+
+typedef enum NetCommandType
+{
+    NET_COMMAND_NETWORK_UP,
+    NET_COMMAND_NETWORK_DOWN,
+    NET_COMMAND_PUBLISH,
+    NET_COMMAND_RECONNECT,
+    NET_COMMAND_INVALIDATE_CREDENTIALS,
+} NetCommandType;
+
+/* topic and payload of a publish follow the command in the same allocation */
+typedef struct NetCommand
+{
+    NetCommandType type;
+    MqttQoS qos;
+    CString topic;
+    CBuffer payload;
+} NetCommand;
+
+static struct
+{
+    CString clientId;
+    CString subscribeFilter;
+    int wakeFd;
+    TLSConnectPhase connectPhase;
+    uint32_t connectStartTimestamp;
+    uint32_t lastMqttServiceTimestamp;
+    TraceSpan connectSpan;
+    bool isFirstPublishTraced;
+    atomic_bool isMessageNotified; /* a message event is pending, later deliveries ride on it */
+    NetMessage *assembling;        /* large message being received in fragments */
+    SpscQueue commands;     /* core -> net */
+    SpscQueue inbound;      /* net -> core */
+    void *commandSlots[NET_QUEUE_SIZE];
+    void *inboundSlots[NET_QUEUE_SIZE];
+} netTask = {0};
+
+static uint32_t NetTask_GetTimeMs(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void NetTask_Wake(void)
+{
+    uint64_t posted = 1;
+    write(netTask.wakeFd, &posted, sizeof(posted));
+}
+
+static NetMessage *NetTask_AllocMessage(CString topic, size_t payloadLength)
+{
+    NetMessage *message = (NetMessage *)malloc(sizeof(NetMessage) + topic.length + payloadLength);
+    if (!message)
+        return NULL;
+
+    char *topicCopy = (char *)(message + 1);
+    memcpy(topicCopy, topic.string, topic.length);
+
+    message->topic = (CString){.string = topicCopy, .length = topic.length};
+    message->payload = (CBuffer){.buffer = (uint8_t *)topicCopy + topic.length, .length = payloadLength};
+    return message;
+}
+
+static void NetTask_Deliver(NetMessage *message)
+{
+    if (!SpscQueue_Push(&netTask.inbound, message))
+    {
+        ESP_LOGE(TAG, "inbound queue full, dropping message on %.*s", (int)message->topic.length, message->topic.string);
+        free(message);
+        return;
+    }
+
+    /* the core drains the whole queue on one event */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_exchange(&netTask.isMessageNotified, true))
+        Core_EventNotify(CORE_EVENT_CLOUD_MESSAGE);
+}
+
+static void NetTask_OnMessage(CString topic, CBuffer payload)
+{
+    NetMessage *message = NetTask_AllocMessage(topic, payload.length);
+    if (!message)
+        return;
+
+    memcpy((uint8_t *)message->payload.buffer, payload.buffer, payload.length);
+    NetTask_Deliver(message);
+}
+
+static void NetTask_OnFragment(CString topic, CBuffer fragment, size_t offset, size_t totalLength)
+{
+    if (offset == 0)
+    {
+        free(netTask.assembling);
+        netTask.assembling = NULL;
+
+        /* the handlers parse the message whole, its size is bounded before allocating */
+        if (totalLength > NET_LARGE_MESSAGE_MAX_SIZE)
+        {
+            ESP_LOGE(TAG, "message on %.*s too large (%u > %u bytes), discarded", (int)topic.length, topic.string, totalLength, NET_LARGE_MESSAGE_MAX_SIZE);
+            return;
+        }
+
+        netTask.assembling = NetTask_AllocMessage(topic, totalLength);
+        if (!netTask.assembling)
+            ESP_LOGE(TAG, "no memory for %u byte message, discarded", totalLength);
+    }
+
+    /* rest of a discarded message */
+    NetMessage *message = netTask.assembling;
+    if (!message)
+        return;
+
+    if (message->payload.length != totalLength || offset + fragment.length > totalLength)
+    {
+        ESP_LOGE(TAG, "dropped fragment at %u/%u", offset, totalLength);
+        return;
+    }
+
+    memcpy((uint8_t *)message->payload.buffer + offset, fragment.buffer, fragment.length);
+
+    /* deliver once complete */
+    if (offset + fragment.length == totalLength)
+    {
+        netTask.assembling = NULL;
+        NetTask_Deliver(message);
+    }
+}
+
+static void NetTask_Disconnect(bool force)
+{
+    Mqtt_Disconnect(force);
+    Core_EventNotify(CORE_EVENT_CLOUD_DISCONNECTED);
+}
+
+static const char *NetTask_GetConnectPhaseName(TLSConnectPhase phase)
+{
+    switch (phase)
+    {
+    case TLS_PHASE_TCP:
+        return "tcp";
+    case TLS_PHASE_HANDSHAKE:
+        return "handshake";
+    default:
+        return "mqtt";
+    }
+}
+
+static void NetTask_ConnectStart(uint32_t now)
+{
+    netTask.connectStartTimestamp = now;
+    netTask.connectSpan = TRACE_BEGIN("mqtt_connect");
+    Supervisor_OnConnectStart(now);
+
+    /* start connection to mqtt broker, completed by NetTask_ConnectStep */
+    if (Mqtt_ConnectStart(netTask.clientId))
+    {
+        Supervisor_OnFailure(SUPERVISOR_FAILURE_CONNECT, now);
+        Core_EventNotify(CORE_EVENT_CLOUD_CONNECT_FAILED);
+        return;
+    }
+
+    netTask.connectPhase = Mqtt_GetConnectPhase();
+    ESP_LOGI(TAG, "cloud: connecting (%s)", NetTask_GetConnectPhaseName(netTask.connectPhase));
+    Core_EventNotify(CORE_EVENT_CLOUD_CONNECTING);
+}
+
+static void NetTask_ConnectStep(uint32_t now)
+{
+    bool sessionPresent = false;
+    MqttConnectStatus status = Mqtt_ConnectStep(&sessionPresent, 0);
+
+    /* report connection progress */
+    TLSConnectPhase phase = Mqtt_GetConnectPhase();
+    if (status == MQTT_CONNECTION_IN_PROGRESS && phase != netTask.connectPhase)
+    {
+        ESP_LOGI(TAG, "cloud: connecting (%s) after %u ms", NetTask_GetConnectPhaseName(phase), now - netTask.connectStartTimestamp);
+        netTask.connectPhase = phase;
+    }
+
+    if (status == MQTT_CONNECTION_IN_PROGRESS)
+        return;
+
+    if (status == MQTT_CONNECTION_FAILED)
+    {
+        ESP_LOGE(TAG, "cloud: connection failed after %u ms", now - netTask.connectStartTimestamp);
+        Supervisor_OnFailure(SUPERVISOR_FAILURE_CONNECT, now);
+        Core_EventNotify(CORE_EVENT_CLOUD_CONNECT_FAILED);
+        return;
+    }
+
+    ESP_LOGI(TAG, "cloud: connected in %u ms", now - netTask.connectStartTimestamp);
+    TRACE_END(netTask.connectSpan);
+    Supervisor_OnConnected(now);
+    netTask.lastMqttServiceTimestamp = now;
+
+    if (!sessionPresent)
+        Mqtt_Subscribe(netTask.subscribeFilter);
+
+    Core_EventNotify(CORE_EVENT_CLOUD_CONNECTED);
+}
+
+static void NetTask_Service(uint32_t now, bool isMqttReadable)
+{
+    /* process mqtt loop on incoming data or when keep-alive is due */
+    if (!isMqttReadable && now - netTask.lastMqttServiceTimestamp < NET_MQTT_SERVICE_INTERVAL_MS)
+        return;
+
+    ErrorCode err = Mqtt_ProcessLoop();
+    netTask.lastMqttServiceTimestamp = now;
+
+    if (err)
+    {
+        /* connection is gone, let the supervisor schedule the next attempt */
+        NetTask_Disconnect(true);
+        Supervisor_OnFailure(err == ESP_ERR_TIMEOUT ? SUPERVISOR_FAILURE_KEEPALIVE : SUPERVISOR_FAILURE_LINK, now);
+    }
+}
+
+static void NetTask_ProcessCommands(uint32_t now)
+{
+    NetCommand *command;
+    while ((command = (NetCommand *)SpscQueue_Pop(&netTask.commands)) != NULL)
+    {
+        switch (command->type)
+        {
+        case NET_COMMAND_NETWORK_UP:
+            Supervisor_OnNetworkUp(now);
+            break;
+        case NET_COMMAND_NETWORK_DOWN:
+        {
+            /* the core already knows, tear down without reporting a cloud disconnect */
+            SupervisorState state = Supervisor_GetState();
+            if (state == SUPERVISOR_STATE_CONNECTED || state == SUPERVISOR_STATE_CONNECTING)
+                Mqtt_Disconnect(true);
+            Supervisor_OnNetworkDown();
+        }
+        break;
+        case NET_COMMAND_PUBLISH:
+            if (Mqtt_Publish(command->topic, command->payload, command->qos) == SUCCESS && !netTask.isFirstPublishTraced)
+            {
+                /* time from boot to the first message leaving the device */
+                TRACE_SINCE_BOOT("first_publish");
+                netTask.isFirstPublishTraced = true;
+            }
+            break;
+        case NET_COMMAND_RECONNECT:
+        {
+            SupervisorState state = Supervisor_GetState();
+            if (state == SUPERVISOR_STATE_CONNECTED || state == SUPERVISOR_STATE_CONNECTING)
+                NetTask_Disconnect(state == SUPERVISOR_STATE_CONNECTING);
+            Supervisor_RequestReconnect(now);
+        }
+        break;
+        case NET_COMMAND_INVALIDATE_CREDENTIALS:
+            Mqtt_InvalidateCredentials();
+            break;
+        }
+
+        free(command);
+    }
+}
+
+static uint32_t NetTask_GetWaitMs(uint32_t now)
+{
+    switch (Supervisor_GetState())
+    {
+    case SUPERVISOR_STATE_BACKOFF:
+        return MIN(Supervisor_GetWaitMs(now), NET_TASK_IDLE_WAIT_MS);
+    case SUPERVISOR_STATE_CONNECTING:
+        return NET_TASK_CONNECTING_PERIOD_MS;
+    case SUPERVISOR_STATE_CONNECTED:
+    {
+        uint32_t elapsed = now - netTask.lastMqttServiceTimestamp;
+        return elapsed >= NET_MQTT_SERVICE_INTERVAL_MS ? 0 : NET_MQTT_SERVICE_INTERVAL_MS - elapsed;
+    }
+    default:
+        return NET_TASK_IDLE_WAIT_MS;
+    }
+}
+
+static bool NetTask_WaitForActivity(uint32_t waitMs)
+{
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    FD_SET(netTask.wakeFd, &readFds);
+    int maxFd = netTask.wakeFd;
+
+    int mqttFd = Supervisor_GetState() == SUPERVISOR_STATE_CONNECTED ? Mqtt_GetSocket() : -1;
+    if (mqttFd >= 0)
+    {
+        FD_SET(mqttFd, &readFds);
+        maxFd = MAX(maxFd, mqttFd);
+    }
+
+    /* data buffered by TLS does not show on the socket, do not sleep on it */
+    bool isMqttPending = mqttFd >= 0 && Mqtt_HasPendingData();
+    if (isMqttPending)
+        waitMs = 0;
+
+    struct timeval timeout = {.tv_sec = waitMs / 1000, .tv_usec = (waitMs % 1000) * 1000};
+    if (select(maxFd + 1, &readFds, NULL, NULL, &timeout) <= 0)
+        return isMqttPending;
+
+    /* commands are drained from the queue, only reset the counter */
+    if (FD_ISSET(netTask.wakeFd, &readFds))
+    {
+        uint64_t posted;
+        read(netTask.wakeFd, &posted, sizeof(posted));
+    }
+
+    return isMqttPending || (mqttFd >= 0 && FD_ISSET(mqttFd, &readFds));
+}
+
+static void NetTask_TaskMain(void *pvParameters)
+{
+    bool isMqttReadable = false;
+
+    /* the mqtt transport lives on this task, its allocations are the ones budgeted */
+    TLSMemory_BindTask();
+
+    while (true)
+    {
+        uint32_t now = NetTask_GetTimeMs();
+
+        NetTask_ProcessCommands(now);
+
+        switch (Supervisor_GetState())
+        {
+        case SUPERVISOR_STATE_BACKOFF:
+            if (Supervisor_ShouldConnect(now))
+                NetTask_ConnectStart(now);
+            break;
+        case SUPERVISOR_STATE_CONNECTING:
+            NetTask_ConnectStep(now);
+            break;
+        case SUPERVISOR_STATE_CONNECTED:
+            NetTask_Service(now, isMqttReadable);
+            break;
+        default:
+            break;
+        }
+
+        /* sleep until a command is queued, mqtt data arrives or the next deadline */
+        isMqttReadable = NetTask_WaitForActivity(NetTask_GetWaitMs(NetTask_GetTimeMs()));
+    }
+}
+
+ErrorCode NetTask_RegisterLargeTopic(CString topic)
+{
+    return Mqtt_RegisterStreamHandler(topic, NetTask_OnFragment);
+}
+
+ErrorCode NetTask_Start(CString clientId, CString subscribeFilter)
+{
+    netTask.clientId = clientId;
+    netTask.subscribeFilter = subscribeFilter;
+
+    SpscQueue_Init(&netTask.commands, netTask.commandSlots, NET_QUEUE_SIZE);
+    SpscQueue_Init(&netTask.inbound, netTask.inboundSlots, NET_QUEUE_SIZE);
+
+    netTask.wakeFd = eventfd(0, 0);
+    if (netTask.wakeFd < 0)
+        return FAILURE;
+
+    ERROR_CHECK(Mqtt_Init(NetTask_OnMessage));
+    Supervisor_Init();
+
+    /* the mqtt context is only touched by this task from now on */
+    if (xTaskCreatePinnedToCore(NetTask_TaskMain, "net_task", NET_TASK_STACK_SIZE, NULL, uxTaskPriorityGet(NULL) + 1, NULL, NET_TASK_CORE) != pdPASS)
+        return FAILURE;
+
+    return SUCCESS;
+}
+
+static ErrorCode NetTask_Send(NetCommandType type, CString topic, CBuffer payload, MqttQoS qos)
+{
+    NetCommand *command = (NetCommand *)malloc(sizeof(NetCommand) + topic.length + payload.length);
+    if (!command)
+        return FAILURE;
+
+    char *data = (char *)(command + 1);
+    if (topic.length > 0)
+        memcpy(data, topic.string, topic.length);
+    if (payload.length > 0)
+        memcpy(data + topic.length, payload.buffer, payload.length);
+
+    command->type = type;
+    command->qos = qos;
+    command->topic = (CString){.string = data, .length = topic.length};
+    command->payload = (CBuffer){.buffer = (uint8_t *)data + topic.length, .length = payload.length};
+
+    if (!SpscQueue_Push(&netTask.commands, command))
+    {
+        ESP_LOGE(TAG, "command queue full, dropping command %d", type);
+        free(command);
+        return FAILURE;
+    }
+
+    NetTask_Wake();
+    return SUCCESS;
+}
+
+void NetTask_NetworkUp(void)
+{
+    NetTask_Send(NET_COMMAND_NETWORK_UP, (CString){0}, (CBuffer){0}, MQTT_QOS0);
+}
+
+void NetTask_NetworkDown(void)
+{
+    NetTask_Send(NET_COMMAND_NETWORK_DOWN, (CString){0}, (CBuffer){0}, MQTT_QOS0);
+}
+
+ErrorCode NetTask_Publish(CString topic, CBuffer data, MqttQoS qos)
+{
+    return NetTask_Send(NET_COMMAND_PUBLISH, topic, data, qos);
+}
+
+ErrorCode NetTask_Reconnect(void)
+{
+    return NetTask_Send(NET_COMMAND_RECONNECT, (CString){0}, (CBuffer){0}, MQTT_QOS0);
+}
+
+ErrorCode NetTask_InvalidateCredentials(void)
+{
+    return NetTask_Send(NET_COMMAND_INVALIDATE_CREDENTIALS, (CString){0}, (CBuffer){0}, MQTT_QOS0);
+}
+
+NetMessage *NetTask_Receive(void)
+{
+    /* cleared before popping, a message pushed after the last pop posts a new event */
+    atomic_store(&netTask.isMessageNotified, false);
+    atomic_thread_fence(memory_order_seq_cst);
+    return (NetMessage *)SpscQueue_Pop(&netTask.inbound);
+}
+
+void NetTask_FreeMessage(NetMessage *message)
+{
+    free(message);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core/error.h"
+#include "net/mqtt.h"
+#include "define.h"
+
+#define NET_TASK_CORE CONFIG_NET_TASK_CORE
+#define NET_TASK_STACK_SIZE 16384
+
+/* capacity of the command and inbound queues, power of two */
+#define NET_QUEUE_SIZE 16
+
+/* longest sleep of the network task when nothing is scheduled */
+#define NET_TASK_IDLE_WAIT_MS 60000
+
+/* period while the cloud connection is being stepped */
+#define NET_TASK_CONNECTING_PERIOD_MS 10
+
+/* mqtt keep-alive and retransmissions are serviced at least this often */
+#define NET_MQTT_SERVICE_INTERVAL_MS 5000
+
+/* streamed messages are assembled whole, larger ones are discarded */
+#define NET_LARGE_MESSAGE_MAX_SIZE CONFIG_NET_LARGE_MESSAGE_MAX_SIZE
+
+/* message received from the cloud, topic and payload share one allocation */
+typedef struct NetMessage
+{
+    CString topic;
+    CBuffer payload;
+} NetMessage;
+
+ErrorCode NetTask_Start(CString clientId, CString subscribeFilter);
+ErrorCode NetTask_RegisterLargeTopic(CString topic);
+
+/* called from the core task only, the queues have a single producer */
+void NetTask_NetworkUp(void);
+void NetTask_NetworkDown(void);
+ErrorCode NetTask_Publish(CString topic, CBuffer data, MqttQoS qos);
+ErrorCode NetTask_Reconnect(void);
+ErrorCode NetTask_InvalidateCredentials(void);
+
+/* inbound messages, consumed by the core task */
+NetMessage *NetTask_Receive(void);
+void NetTask_FreeMessage(NetMessage *message);
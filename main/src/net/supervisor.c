@@ -0,0 +1,170 @@
+#include "net/supervisor.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "telemetry/stats.h"
+
+static const char *TAG = "Supervisor";
+
+static struct
+{
+    SupervisorState state;
+    uint32_t nextAttemptTimestamp;
+    uint32_t connectStartTimestamp;
+    uint32_t attempts;
+    uint32_t successes;
+    uint32_t consecutiveFailures;
+    uint8_t health;
+} supervisor = {0};
+
+static const char *Supervisor_GetFailureName(SupervisorFailure failure)
+{
+    switch (failure)
+    {
+    case SUPERVISOR_FAILURE_LINK:
+        return "link lost";
+    case SUPERVISOR_FAILURE_KEEPALIVE:
+        return "keep-alive missed";
+    default:
+        return "connect failed";
+    }
+}
+
+static uint32_t Supervisor_Jitter(uint32_t delayMs)
+{
+    /* equal jitter: keep half of the delay, randomize the other half */
+    uint32_t half = delayMs / 2;
+    return half + (half > 0 ? esp_random() % (half + 1) : 0);
+}
+
+static void Supervisor_Schedule(uint32_t now, uint32_t delayMs)
+{
+    supervisor.state = SUPERVISOR_STATE_BACKOFF;
+    Stats_SetGauge(STAT_CONNECT_BACKOFF_MS, delayMs);
+    supervisor.nextAttemptTimestamp = now + delayMs;
+}
+
+uint32_t Supervisor_ComputeBackoffMs(uint32_t failures)
+{
+    /* exponential growth capped at the maximum, then jittered */
+    uint32_t shift = MIN(failures > 0 ? failures - 1 : 0, 16);
+    uint32_t delayMs = MIN((uint64_t)SUPERVISOR_BACKOFF_BASE_MS << shift, SUPERVISOR_BACKOFF_MAX_MS);
+    return Supervisor_Jitter(delayMs);
+}
+
+void Supervisor_Init(void)
+{
+    memset(&supervisor, 0, sizeof(supervisor));
+    supervisor.health = SUPERVISOR_HEALTH_MAX;
+    Stats_SetGauge(STAT_LINK_HEALTH, supervisor.health);
+}
+
+void Supervisor_OnNetworkUp(uint32_t now)
+{
+    if (supervisor.state != SUPERVISOR_STATE_OFFLINE)
+        return;
+
+    /* spread the first attempt of devices sharing an access point */
+    Supervisor_Schedule(now, Supervisor_Jitter(SUPERVISOR_FAST_RETRY_MS));
+}
+
+void Supervisor_OnNetworkDown(void)
+{
+    /* nothing is scheduled until the network is back */
+    supervisor.state = SUPERVISOR_STATE_OFFLINE;
+    supervisor.consecutiveFailures = 0;
+}
+
+void Supervisor_RequestReconnect(uint32_t now)
+{
+    if (supervisor.state == SUPERVISOR_STATE_OFFLINE)
+        return;
+
+    /* requested by the application, not a failure */
+    supervisor.consecutiveFailures = 0;
+    Supervisor_Schedule(now, 0);
+}
+
+bool Supervisor_ShouldConnect(uint32_t now)
+{
+    return supervisor.state == SUPERVISOR_STATE_BACKOFF && (int32_t)(now - supervisor.nextAttemptTimestamp) >= 0;
+}
+
+void Supervisor_OnConnectStart(uint32_t now)
+{
+    supervisor.state = SUPERVISOR_STATE_CONNECTING;
+    supervisor.connectStartTimestamp = now;
+    supervisor.attempts++;
+    Stats_Increment(STAT_CONNECT_ATTEMPTS);
+}
+
+void Supervisor_OnConnected(uint32_t now)
+{
+    uint32_t durationMs = now - supervisor.connectStartTimestamp;
+
+    supervisor.state = SUPERVISOR_STATE_CONNECTED;
+    supervisor.successes++;
+    /* the histogram keeps count, total and max, the gauge the last one */
+    Stats_Observe(STAT_CLOUD_CONNECT_MS, durationMs);
+    Stats_SetGauge(STAT_CLOUD_CONNECT_LAST_MS, durationMs);
+    if (supervisor.successes > 1)
+        Stats_Increment(STAT_RECONNECTS);
+    supervisor.consecutiveFailures = 0;
+    supervisor.health = MIN(supervisor.health + 20, SUPERVISOR_HEALTH_MAX);
+    Stats_SetGauge(STAT_LINK_HEALTH, supervisor.health);
+
+    ESP_LOGI(TAG, "connected in %lu ms (attempt %lu, health %u)", (unsigned long)durationMs, (unsigned long)supervisor.attempts, supervisor.health);
+}
+
+void Supervisor_OnFailure(SupervisorFailure failure, uint32_t now)
+{
+    bool wasHealthy = supervisor.health >= SUPERVISOR_HEALTH_HEALTHY;
+    uint8_t penalty = 25;
+
+    switch (failure)
+    {
+    case SUPERVISOR_FAILURE_LINK:
+        Stats_Increment(STAT_LINK_LOSSES);
+        penalty = 10;
+        break;
+    case SUPERVISOR_FAILURE_KEEPALIVE:
+        Stats_Increment(STAT_KEEPALIVE_MISSES);
+        penalty = 20;
+        break;
+    default:
+        Stats_Increment(STAT_CONNECT_FAILURES);
+        break;
+    }
+
+    supervisor.health = supervisor.health > penalty ? supervisor.health - penalty : 0;
+    supervisor.consecutiveFailures++;
+    Stats_SetGauge(STAT_LINK_HEALTH, supervisor.health);
+
+    /* a drop on a healthy link is likely transient, retry right away */
+    bool isFastRetry = failure != SUPERVISOR_FAILURE_CONNECT && wasHealthy && supervisor.consecutiveFailures == 1;
+    uint32_t delayMs = isFastRetry ? Supervisor_Jitter(SUPERVISOR_FAST_RETRY_MS) : Supervisor_ComputeBackoffMs(supervisor.consecutiveFailures);
+
+    ESP_LOGW(TAG, "%s, retry in %lu ms (failures %lu, health %u)", Supervisor_GetFailureName(failure), (unsigned long)delayMs,
+             (unsigned long)supervisor.consecutiveFailures, supervisor.health);
+
+    if (supervisor.state != SUPERVISOR_STATE_OFFLINE)
+        Supervisor_Schedule(now, delayMs);
+}
+
+uint32_t Supervisor_GetWaitMs(uint32_t now)
+{
+    if (supervisor.state != SUPERVISOR_STATE_BACKOFF)
+        return UINT32_MAX;
+
+    int32_t remaining = (int32_t)(supervisor.nextAttemptTimestamp - now);
+    return remaining > 0 ? (uint32_t)remaining : 0;
+}
+
+SupervisorState Supervisor_GetState(void)
+{
+    return supervisor.state;
+}
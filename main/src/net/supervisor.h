@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SUPERVISOR_BACKOFF_BASE_MS CONFIG_SUPERVISOR_BACKOFF_BASE_MS
+#define SUPERVISOR_BACKOFF_MAX_MS CONFIG_SUPERVISOR_BACKOFF_MAX_MS
+#define SUPERVISOR_FAST_RETRY_MS CONFIG_SUPERVISOR_FAST_RETRY_MS
+
+/* health score, a healthy link gets a fast retry after a transient error */
+#define SUPERVISOR_HEALTH_MAX 100
+#define SUPERVISOR_HEALTH_HEALTHY 60
+
+typedef enum SupervisorState
+{
+    SUPERVISOR_STATE_OFFLINE,
+    SUPERVISOR_STATE_BACKOFF,
+    SUPERVISOR_STATE_CONNECTING,
+    SUPERVISOR_STATE_CONNECTED,
+} SupervisorState;
+
+typedef enum SupervisorFailure
+{
+    SUPERVISOR_FAILURE_CONNECT,
+    SUPERVISOR_FAILURE_LINK,
+    SUPERVISOR_FAILURE_KEEPALIVE,
+} SupervisorFailure;
+
+void Supervisor_Init(void);
+void Supervisor_OnNetworkUp(uint32_t now);
+void Supervisor_OnNetworkDown(void);
+void Supervisor_RequestReconnect(uint32_t now);
+bool Supervisor_ShouldConnect(uint32_t now);
+void Supervisor_OnConnectStart(uint32_t now);
+void Supervisor_OnConnected(uint32_t now);
+void Supervisor_OnFailure(SupervisorFailure failure, uint32_t now);
+uint32_t Supervisor_GetWaitMs(uint32_t now);
+SupervisorState Supervisor_GetState(void);
+uint32_t Supervisor_ComputeBackoffMs(uint32_t failures);
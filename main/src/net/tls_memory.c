@@ -0,0 +1,290 @@
+#include "net/tls_memory.h"
+
+#include "mbedtls/platform.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "multi_heap.h"
+#include "esp_heap_caps.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "TLSMemory";
+
+#if defined(CONFIG_TLS_MEMORY_BUDGET_ENABLE) && defined(MBEDTLS_PLATFORM_MEMORY)
+
+/* size and owner of each block, keeps the payload 8 bytes aligned */
+typedef struct
+{
+    uint32_t total;
+    uint32_t isBudgeted;
+} AllocHeader;
+
+#define ALLOC_HEADER_SIZE sizeof(AllocHeader)
+_Static_assert(sizeof(AllocHeader) == 8, "allocation header must keep 8 byte alignment");
+
+#if TLS_HANDSHAKE_POOL_SIZE > 0
+static uint8_t tls_pool[TLS_HANDSHAKE_POOL_SIZE] __attribute__((aligned(8)));
+static portMUX_TYPE tls_poolLock = portMUX_INITIALIZER_UNLOCKED;
+#else
+static uint8_t *tls_pool = NULL;
+#endif
+static multi_heap_handle_t tls_poolHeap = NULL;
+
+static portMUX_TYPE tls_statsLock = portMUX_INITIALIZER_UNLOCKED;
+static TLSMemoryStats tls_stats = {0};
+
+/* the allocator is process-wide, other tasks (csr, http client) bypass the budget */
+static struct
+{
+    TaskHandle_t task;
+    bool isPaused;
+} tls_scope = {0};
+
+static bool TLSMemory_IsInScope(void)
+{
+    return tls_scope.task != NULL && !tls_scope.isPaused && tls_scope.task == xTaskGetCurrentTaskHandle();
+}
+
+static bool TLSMemory_IsPoolPointer(const void *ptr)
+{
+    return tls_poolHeap != NULL && (const uint8_t *)ptr >= tls_pool && (const uint8_t *)ptr < tls_pool + TLS_HANDSHAKE_POOL_SIZE;
+}
+
+static bool TLSMemory_Reserve(size_t size)
+{
+    bool granted = false;
+
+    portENTER_CRITICAL(&tls_statsLock);
+    if (tls_stats.used + size <= TLS_MEMORY_BUDGET)
+    {
+        tls_stats.used += size;
+        if (tls_stats.used > tls_stats.peak)
+            tls_stats.peak = tls_stats.used;
+        granted = true;
+    }
+    else
+    {
+        tls_stats.failures++;
+    }
+    portEXIT_CRITICAL(&tls_statsLock);
+
+    return granted;
+}
+
+static void TLSMemory_Release(size_t size, bool fromPool)
+{
+    portENTER_CRITICAL(&tls_statsLock);
+    tls_stats.used -= size;
+    if (fromPool)
+        tls_stats.poolUsed -= size;
+    portEXIT_CRITICAL(&tls_statsLock);
+}
+
+static void *TLSMemory_Calloc(size_t count, size_t size)
+{
+    if (size != 0 && count > (SIZE_MAX - ALLOC_HEADER_SIZE) / size)
+        return NULL;
+
+    size_t length = count * size;
+    size_t total = length + ALLOC_HEADER_SIZE;
+    AllocHeader header = {.total = total, .isBudgeted = TLSMemory_IsInScope()};
+
+    if (!header.isBudgeted)
+    {
+        uint8_t *block = calloc(1, total);
+        if (!block)
+            return NULL;
+
+        memcpy(block, &header, sizeof(header));
+        return block + ALLOC_HEADER_SIZE;
+    }
+
+    if (!TLSMemory_Reserve(total))
+    {
+        ESP_LOGW(TAG, "allocation of %u bytes exceeds the budget", length);
+        return NULL;
+    }
+
+    /* serve from the static pool first, then fallback to the heap */
+    bool fromPool = false;
+    uint8_t *block = NULL;
+    if (tls_poolHeap)
+    {
+        block = multi_heap_malloc(tls_poolHeap, total);
+        fromPool = block != NULL;
+    }
+
+    if (!block)
+        block = malloc(total);
+
+    if (!block)
+    {
+        TLSMemory_Release(total, false);
+        return NULL;
+    }
+
+    if (fromPool)
+    {
+        portENTER_CRITICAL(&tls_statsLock);
+        tls_stats.poolUsed += total;
+        portEXIT_CRITICAL(&tls_statsLock);
+    }
+
+    memcpy(block, &header, sizeof(header));
+    memset(block + ALLOC_HEADER_SIZE, 0, length);
+
+    return block + ALLOC_HEADER_SIZE;
+}
+
+static void TLSMemory_Free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    uint8_t *block = (uint8_t *)ptr - ALLOC_HEADER_SIZE;
+    AllocHeader header;
+    memcpy(&header, block, sizeof(header));
+
+    if (!header.isBudgeted)
+    {
+        free(block);
+        return;
+    }
+
+    bool fromPool = TLSMemory_IsPoolPointer(block);
+    if (fromPool)
+        multi_heap_free(tls_poolHeap, block);
+    else
+        free(block);
+
+    TLSMemory_Release(header.total, fromPool);
+}
+
+ErrorCode TLSMemory_Init(void)
+{
+#if TLS_HANDSHAKE_POOL_SIZE > 0
+    if (!tls_poolHeap)
+    {
+        tls_poolHeap = multi_heap_register(tls_pool, sizeof(tls_pool));
+        if (tls_poolHeap)
+            multi_heap_set_lock(tls_poolHeap, &tls_poolLock);
+        else
+            ESP_LOGW(TAG, "failed to register static pool, using heap only");
+    }
+#endif
+
+    if (mbedtls_platform_set_calloc_free(TLSMemory_Calloc, TLSMemory_Free))
+    {
+        ESP_LOGE(TAG, "failed to install allocator");
+        return FAILURE;
+    }
+
+    ESP_LOGI(TAG, "mqtt transport budget %d bytes, static pool %d bytes", TLS_MEMORY_BUDGET, TLS_HANDSHAKE_POOL_SIZE);
+
+    return SUCCESS;
+}
+
+void TLSMemory_BindTask(void)
+{
+    tls_scope.task = xTaskGetCurrentTaskHandle();
+    tls_scope.isPaused = false;
+}
+
+void TLSMemory_Pause(void)
+{
+    if (tls_scope.task == xTaskGetCurrentTaskHandle())
+        tls_scope.isPaused = true;
+}
+
+void TLSMemory_Resume(void)
+{
+    if (tls_scope.task == xTaskGetCurrentTaskHandle())
+        tls_scope.isPaused = false;
+}
+
+void TLSMemory_ResetPeak(void)
+{
+    portENTER_CRITICAL(&tls_statsLock);
+    tls_stats.peak = tls_stats.used;
+    portEXIT_CRITICAL(&tls_statsLock);
+}
+
+void TLSMemory_Sample(void)
+{
+}
+
+void TLSMemory_GetStats(TLSMemoryStats *outStats)
+{
+    portENTER_CRITICAL(&tls_statsLock);
+    *outStats = tls_stats;
+    portEXIT_CRITICAL(&tls_statsLock);
+}
+
+#else
+
+ErrorCode TLSMemory_Init(void)
+{
+#if defined(CONFIG_TLS_MEMORY_BUDGET_ENABLE)
+    ESP_LOGW(TAG, "mbedtls platform memory is disabled, budget not enforced");
+#endif
+    return SUCCESS;
+}
+
+void TLSMemory_BindTask(void)
+{
+}
+
+void TLSMemory_Pause(void)
+{
+}
+
+void TLSMemory_Resume(void)
+{
+}
+
+/* without accounting the connection is measured on the whole heap, only the net task connects */
+static struct
+{
+    size_t baselineFree;
+    size_t baselineMinimum;
+    size_t lowestFree;
+} tls_heap = {0};
+
+void TLSMemory_ResetPeak(void)
+{
+    tls_heap.baselineFree = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    tls_heap.baselineMinimum = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    tls_heap.lowestFree = tls_heap.baselineFree;
+}
+
+void TLSMemory_Sample(void)
+{
+    size_t freeSize = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (freeSize < tls_heap.lowestFree)
+        tls_heap.lowestFree = freeSize;
+}
+
+void TLSMemory_GetStats(TLSMemoryStats *outStats)
+{
+    memset(outStats, 0, sizeof(TLSMemoryStats));
+    outStats->isHeapEstimate = true;
+
+    TLSMemory_Sample();
+
+    /* a new all-time minimum was reached during this connection, it is exact where sampling is not */
+    size_t lowestFree = tls_heap.lowestFree;
+    size_t minimum = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    if (minimum < tls_heap.baselineMinimum && minimum < lowestFree)
+        lowestFree = minimum;
+
+    size_t freeSize = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    outStats->used = tls_heap.baselineFree > freeSize ? tls_heap.baselineFree - freeSize : 0;
+    outStats->peak = tls_heap.baselineFree > lowestFree ? tls_heap.baselineFree - lowestFree : 0;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core/error.h"
+
+#define TLS_MEMORY_BUDGET CONFIG_TLS_MEMORY_BUDGET
+#define TLS_HANDSHAKE_POOL_SIZE CONFIG_TLS_HANDSHAKE_POOL_SIZE
+
+typedef struct
+{
+    size_t used;     // bytes currently held by mbedtls
+    size_t peak;     // highest usage since last reset
+    size_t poolUsed; // bytes currently served by the static pool
+    size_t failures; // allocations refused by the budget
+    bool isHeapEstimate; // no accounting, used and peak are heap deltas since the reset
+} TLSMemoryStats;
+
+ErrorCode TLSMemory_Init(void);
+/* only mbedtls allocations of the bound task (the mqtt transport) count against the budget */
+void TLSMemory_BindTask(void);
+/* the bound task leaves the budget in between, e.g. to derive its key from the puf */
+void TLSMemory_Pause(void);
+void TLSMemory_Resume(void);
+void TLSMemory_ResetPeak(void);
+/* tracks the heap low point between handshake steps, no-op with accounting */
+void TLSMemory_Sample(void);
+void TLSMemory_GetStats(TLSMemoryStats *outStats);
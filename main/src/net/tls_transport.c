@@ -2,27 +2,60 @@
 #include <mbedtls/ssl.h>
 #include <mbedtls/net_sockets.h>
 #include <mbedtls/timing.h>
-#include <mbedtls/entropy.h>
-#include <mbedtls/ctr_drbg.h>
 #include <mbedtls/error.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
+
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
 
 #include "define.h"
 #include "crypto/crypto.h"
 #include "net/tls_transport.h"
+#include "net/tls_memory.h"
 #include "core/nvs.h"
 #include "core/core.h"
+#include "core/rtc_store.h"
+#include "core/trace.h"
+#include "telemetry/stats.h"
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 
 static const char *TAG = "TLS";
 
-extern const uint8_t server_cert_pem_start[] asm("_binary_amazon_rootca_crt_start");
-extern const uint8_t server_cert_pem_end[] asm("_binary_amazon_rootca_crt_end");
+extern const uint8_t server_cert_der_start[] asm("_binary_amazon_rootca_der_start");
+extern const uint8_t server_cert_der_end[] asm("_binary_amazon_rootca_der_end");
 // const char *client_crt = "-----BEGIN CERTIFICATE-----\nMIIBPzCB5QIJAPf/AflLn/3EMAoGCCqGSM49BAMCMB0xCzAJBgNVBAYTAklUMQ4wDAYDVQQKDAVVTklWUjAeFw0yMzA3MDQyMTM5NDRaFw0yNDA3MDMyMTM5NDRaMDIxCzAJBgNVBAYTAklUMRMwEQYDVQQDDAplc3AzMi1jcmlzMQ4wDAYDVQQKDAVVTklWUjBZMBMGByqGSM49AgEGCCqGSM49AwEHA0IABNzrRSH7qZu5DVeY6rH0Aojqwi1itWfZNIkxDpkTqOZzmAGNv9Yz4SX1BBlPHdWDdF2LSIZq6DagiJGxRzk+OoIwCgYIKoZIzj0EAwIDSQAw\nRgIhAIi1NvkvwGVOgBUUmd+YSUSiBp+3eDzCy4hyUe+7PF33AiEA7EztUGvvc+Ne1qWhczZnAYsIcWtyIBQgMFKHZ2bXDr4=\n-----END CERTIFICATE-----";
 
+/* give up connecting after this time */
+#define TLS_CONNECT_TIMEOUT_MS 20000
+
+/* time a blocking connect waits for the socket in each step */
+#define TLS_CONNECT_STEP_WAIT_MS 100
+
+/* maximum fragment length negotiated with the server */
+#define TLS_MAX_FRAGMENT_LEN CONFIG_TLS_MAX_FRAGMENT_LEN
+
+/* serialized session kept in rtc slow memory across deep sleep */
+#define RTC_SESSION_MAGIC 0x544c5331 // TLS1
+#define RTC_SESSION_MAX_LEN 2048
+
+typedef struct
+{
+    char certKey[16];
+    uint8_t session[RTC_SESSION_MAX_LEN];
+} RtcSessionData;
+
+static RTC_DATA_ATTR struct
+{
+    RtcStoreHeader header;
+    RtcSessionData data;
+} rtcSession;
+
 struct NetworkContext
 {
     mbedtls_net_context net;
@@ -31,15 +64,27 @@ struct NetworkContext
     mbedtls_x509_crt clientCertificate;
     mbedtls_x509_crt rootCertificate;
     mbedtls_pk_context privateKey;
-    mbedtls_entropy_context entropy;
-    mbedtls_ctr_drbg_context ctrDrbg;
+    mbedtls_ssl_session session;
+    TLSConnectPhase phase;
+    int64_t connectStartMs;
+    int64_t handshakeStartMs;
+    TraceSpan tcpSpan;
+    TraceSpan handshakeSpan;
     bool isConnected;
+    bool isResumed;
+    bool hasSession;
+    bool isSessionCacheEnabled; /* false for short-lived contexts, they never resume nor persist */
+    char sessionCertKey[16];
+    bool hasClientCertificate;
+    bool hasRootCertificate;
+    char clientCertificateKey[16];
     const char *hostname;
     const char *rootCaPath;
     const char *clientCertPath;
     const char *clientKeyPath;
     char port[8];
     uint32_t recvTimeoutMs;
+    uint32_t recvWaitMs;
 };
 
 static void PrintError(int errorCode, const char *reason)
@@ -51,8 +96,14 @@ static void PrintError(int errorCode, const char *reason)
     ESP_LOGE(TAG, "TLS: %s (%s)", reason, message);
 }
 
+static bool TLSTransport_WaitSocket(int fd, bool forWrite, uint32_t waitMs);
+
 int32_t TLSTransport_Recv(struct NetworkContext *ctx, void *pBuffer, size_t bytesToRecv)
 {
+    /* data already buffered by mbedtls is served first, otherwise wait for the socket */
+    if (!TLSTransport_HasPendingData(ctx) && !TLSTransport_WaitSocket(ctx->net.fd, false, ctx->recvWaitMs))
+        return 0;
+
     int result = mbedtls_ssl_read(&ctx->ssl, pBuffer, bytesToRecv);
 
     if (result < 0 && result != MBEDTLS_ERR_SSL_TIMEOUT)
@@ -77,19 +128,284 @@ int32_t TLSTransport_Send(struct NetworkContext *ctx, const void *pBuffer, size_
     return result;
 }
 
+/* short-lived contexts (bench) stay out of the production stats, trace and memory accounting */
+static bool TLSTransport_IsInstrumented(struct NetworkContext *ctx)
+{
+    return ctx->isSessionCacheEnabled;
+}
+
+static void TLSTransport_DropSession(struct NetworkContext *ctx)
+{
+    if (ctx->hasSession)
+        mbedtls_ssl_session_free(&ctx->session);
+
+    ctx->hasSession = false;
+    ctx->sessionCertKey[0] = '\0';
+
+    if (ctx->isSessionCacheEnabled)
+        RtcStore_Clear(&rtcSession.header);
+}
+
+static void TLSTransport_PersistSession(struct NetworkContext *ctx)
+{
+    size_t length = 0;
+    int error = mbedtls_ssl_session_save(&ctx->session, rtcSession.data.session, sizeof(rtcSession.data.session), &length);
+    if (error)
+    {
+        /* deep sleep will cost a full handshake */
+        PrintError(error, "failed to persist session");
+        RtcStore_Clear(&rtcSession.header);
+        return;
+    }
+
+    snprintf(rtcSession.data.certKey, sizeof(rtcSession.data.certKey), "%s", ctx->sessionCertKey);
+    RtcStore_Seal(&rtcSession.header, RTC_SESSION_MAGIC, &rtcSession.data, offsetof(RtcSessionData, session) + length);
+}
+
+static void TLSTransport_RestoreSession(struct NetworkContext *ctx)
+{
+    size_t sessionOffset = offsetof(RtcSessionData, session);
+    if (!RtcStore_Verify(&rtcSession.header, RTC_SESSION_MAGIC, &rtcSession.data, sizeof(rtcSession.data)) || rtcSession.header.length <= sessionOffset)
+        return;
+
+    mbedtls_ssl_session_init(&ctx->session);
+    int error = mbedtls_ssl_session_load(&ctx->session, rtcSession.data.session, rtcSession.header.length - sessionOffset);
+    if (error)
+    {
+        PrintError(error, "failed to restore session");
+        mbedtls_ssl_session_free(&ctx->session);
+        RtcStore_Clear(&rtcSession.header);
+        return;
+    }
+
+    ctx->hasSession = true;
+    snprintf(ctx->sessionCertKey, sizeof(ctx->sessionCertKey), "%s", rtcSession.data.certKey);
+    ESP_LOGI(TAG, "transport: restored session from rtc memory");
+}
+
+static bool TLSTransport_IsSameSession(const mbedtls_ssl_session *offered, const mbedtls_ssl_session *negotiated)
+{
+    /* a full handshake always derives a new master secret, a resumed one (id or ticket) keeps it */
+    return offered->ciphersuite == negotiated->ciphersuite &&
+           memcmp(offered->master, negotiated->master, sizeof(offered->master)) == 0;
+}
+
+static void TLSTransport_SaveSession(struct NetworkContext *ctx)
+{
+    if (!ctx->isSessionCacheEnabled)
+        return;
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    int error = mbedtls_ssl_get_session(&ctx->ssl, &session);
+    if (error)
+    {
+        PrintError(error, "failed to save session");
+        mbedtls_ssl_session_free(&session);
+        TLSTransport_DropSession(ctx);
+        return;
+    }
+
+    ctx->isResumed = ctx->hasSession && TLSTransport_IsSameSession(&ctx->session, &session);
+
+    TLSTransport_DropSession(ctx);
+
+    ctx->session = session;
+    ctx->hasSession = true;
+    snprintf(ctx->sessionCertKey, sizeof(ctx->sessionCertKey), "%s", ctx->clientCertificateKey);
+
+    /* keep a copy that survives deep sleep */
+    TLSTransport_PersistSession(ctx);
+}
+
+static void TLSTransport_FreeCredentials(struct NetworkContext *ctx)
+{
+    if (ctx->hasClientCertificate)
+        mbedtls_x509_crt_free(&ctx->clientCertificate);
+
+    if (ctx->hasRootCertificate)
+        mbedtls_x509_crt_free(&ctx->rootCertificate);
+
+    ctx->hasClientCertificate = false;
+    ctx->hasRootCertificate = false;
+    ctx->clientCertificateKey[0] = '\0';
+}
+
+static int TLSTransport_LoadClientCertificate(struct NetworkContext *ctx, const char *certKey)
+{
+    /* certificate already parsed from the same nvs entry */
+    if (ctx->hasClientCertificate && strcmp(ctx->clientCertificateKey, certKey) == 0)
+        return 0;
+
+    if (ctx->hasClientCertificate)
+    {
+        mbedtls_x509_crt_free(&ctx->clientCertificate);
+        ctx->hasClientCertificate = false;
+    }
+
+    /* sessions are bound to the client identity they were negotiated with */
+    if (strcmp(ctx->sessionCertKey, certKey) != 0)
+        TLSTransport_DropSession(ctx);
+
+    Buffer deviceCert;
+    if (!Nvs_GetBuffer(certKey, &deviceCert))
+        return 0;
+
+    ESP_LOGI(TAG, "cloud: loading client certificate...");
+
+    /* certificates are stored as der */
+    mbedtls_x509_crt_init(&ctx->clientCertificate);
+    int error = mbedtls_x509_crt_parse_der(&ctx->clientCertificate, deviceCert.buffer, deviceCert.length);
+
+    // DEBUG
+    // error = mbedtls_x509_crt_parse(&ctx->clientCertificate, (uint8_t *)client_crt, 1 + strlen((char *)client_crt));
+
+    free(deviceCert.buffer);
+
+    if (error)
+    {
+        mbedtls_x509_crt_free(&ctx->clientCertificate);
+        return error;
+    }
+
+    ctx->hasClientCertificate = true;
+    snprintf(ctx->clientCertificateKey, sizeof(ctx->clientCertificateKey), "%s", certKey);
+
+    return 0;
+}
+
+static int TLSTransport_LoadRootCertificate(struct NetworkContext *ctx)
+{
+    if (ctx->hasRootCertificate)
+        return 0;
+
+    ESP_LOGI(TAG, "cloud: loading SERVER certificate...");
+
+    mbedtls_x509_crt_init(&ctx->rootCertificate);
+
+    // error = mbedtls_x509_crt_parse_file(&ctx->rootCertificate, ctx->rootCaPath);
+    int error = mbedtls_x509_crt_parse_der(&ctx->rootCertificate, server_cert_der_start, server_cert_der_end - server_cert_der_start);
+    if (error)
+    {
+        mbedtls_x509_crt_free(&ctx->rootCertificate);
+        return error;
+    }
+
+    ctx->hasRootCertificate = true;
+
+    return 0;
+}
+
+static unsigned char TLSTransport_GetMaxFragmentCode(void)
+{
+    switch (TLS_MAX_FRAGMENT_LEN)
+    {
+    case 512:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+    case 1024:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+    case 2048:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+    case 4096:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+    default:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+    }
+}
+
+static bool TLSTransport_WaitSocket(int fd, bool forWrite, uint32_t waitMs)
+{
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    struct timeval timeout = {.tv_sec = waitMs / 1000, .tv_usec = (waitMs % 1000) * 1000};
+    int result = select(fd + 1, forWrite ? NULL : &fds, forWrite ? &fds : NULL, NULL, &timeout);
+
+    return result > 0;
+}
+
+static int TLSTransport_StartTcp(struct NetworkContext *ctx)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_protocol = IPPROTO_TCP,
+    };
+    struct addrinfo *addrList = NULL;
+
+    /* name resolution is still blocking, lwip caches the result */
+    if (getaddrinfo(ctx->hostname, ctx->port, &hints, &addrList) != 0 || addrList == NULL)
+        return MBEDTLS_ERR_NET_UNKNOWN_HOST;
+
+    int fd = socket(addrList->ai_family, addrList->ai_socktype, addrList->ai_protocol);
+    if (fd < 0)
+    {
+        freeaddrinfo(addrList);
+        return MBEDTLS_ERR_NET_SOCKET_FAILED;
+    }
+
+    ctx->net.fd = fd;
+    mbedtls_net_set_nonblock(&ctx->net);
+
+    int result = connect(fd, addrList->ai_addr, addrList->ai_addrlen);
+    freeaddrinfo(addrList);
+
+    if (result != 0 && errno != EINPROGRESS)
+        return MBEDTLS_ERR_NET_CONNECT_FAILED;
+
+    return 0;
+}
+
+static void TLSTransport_Cleanup(struct NetworkContext *ctx)
+{
+    mbedtls_ssl_free(&ctx->ssl);
+    mbedtls_ssl_config_free(&ctx->config);
+    mbedtls_pk_free(&ctx->privateKey);
+    mbedtls_net_free(&ctx->net);
+
+    ctx->phase = TLS_PHASE_IDLE;
+    ctx->isConnected = false;
+}
+
+void TLSTransport_InvalidateCredentials(struct NetworkContext *ctx)
+{
+    ESP_LOGI(TAG, "transport: drop cached client certificate");
+
+    TLSTransport_DropSession(ctx);
+
+    /* the parsed certificate may still be referenced by the ssl context,
+     * so it is only marked stale and reloaded on next connection */
+    ctx->clientCertificateKey[0] = '\0';
+}
+
+void TLSTransport_DisableSessionCache(struct NetworkContext *ctx)
+{
+    /* the session restored at init belongs to the mqtt connection, leave its rtc copy alone */
+    ctx->isSessionCacheEnabled = false;
+    TLSTransport_DropSession(ctx);
+}
+
 struct NetworkContext *TLSTransport_Init(const char *hostname, uint16_t port, uint32_t recvTimeoutMs, const char *rootCaPath, const char *clientCertPath, const char *clientKeyPath)
 {
     ESP_LOGI(TAG, "transport: init with %s:%u", hostname, port);
 
     struct NetworkContext *ctx = calloc(1, sizeof(struct NetworkContext));
+    mbedtls_net_init(&ctx->net);
     ctx->isConnected = false;
+    ctx->phase = TLS_PHASE_IDLE;
     ctx->hostname = hostname;
     ctx->rootCaPath = rootCaPath;
     ctx->clientCertPath = clientCertPath;
     ctx->clientKeyPath = clientKeyPath;
     ctx->recvTimeoutMs = recvTimeoutMs;
+    ctx->recvWaitMs = recvTimeoutMs;
+    ctx->isSessionCacheEnabled = true;
     snprintf(ctx->port, sizeof(ctx->port), "%u", port);
 
+    /* resume the session negotiated before deep sleep, if any */
+    TLSTransport_RestoreSession(ctx);
+
     return ctx;
 }
 
@@ -100,25 +416,31 @@ void TLSTransport_Free(struct NetworkContext *ctx)
         TLSTransport_Disconnect(ctx, true);
     }
 
+    if (ctx->hasSession)
+        mbedtls_ssl_session_free(&ctx->session);
+
+    TLSTransport_FreeCredentials(ctx);
     free(ctx);
 }
 
-ErrorCode TLSTransport_Connect(struct NetworkContext *ctx)
+ErrorCode TLSTransport_ConnectStart(struct NetworkContext *ctx)
 {
-    if (ctx->isConnected)
+    if (ctx->isConnected || ctx->phase != TLS_PHASE_IDLE)
     {
         TLSTransport_Disconnect(ctx, true);
     }
 
     ctx->isConnected = false;
+    ctx->isResumed = false;
+
+    /* measure memory used by this connection */
+    if (TLSTransport_IsInstrumented(ctx))
+        TLSMemory_ResetPeak();
 
     /* init everything upfront so we can free everything in one pass */
     mbedtls_ssl_config_init(&ctx->config);
-    mbedtls_entropy_init(&ctx->entropy);
-    mbedtls_ctr_drbg_init(&ctx->ctrDrbg);
     mbedtls_ssl_init(&ctx->ssl);
     mbedtls_net_init(&ctx->net);
-    mbedtls_x509_crt_init(&ctx->rootCertificate);
     mbedtls_pk_init(&ctx->privateKey);
 
     /* init config */
@@ -129,39 +451,41 @@ ErrorCode TLSTransport_Connect(struct NetworkContext *ctx)
         goto err;
     }
 
-    /* init RNG */
-    error = mbedtls_ctr_drbg_seed(&ctx->ctrDrbg, mbedtls_entropy_func, &ctx->entropy, NULL, 0);
+    /* use the shared RNG */
+    mbedtls_ssl_conf_rng(&ctx->config, Crypto_Random, NULL);
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    /* smaller records let mbedtls shrink its 16KB in/out buffers */
+    error = mbedtls_ssl_conf_max_frag_len(&ctx->config, TLSTransport_GetMaxFragmentCode());
     if (error)
     {
-        PrintError(error, "failed init RNG");
+        PrintError(error, "failed to set max fragment length");
         goto err;
     }
+#endif
 
-    mbedtls_ssl_conf_rng(&ctx->config, mbedtls_ctr_drbg_random, &ctx->ctrDrbg);
-
-    Buffer deviceCert;
-    bool hasClientCert = Nvs_GetBuffer(Core_GetCrtNvsKey(), &deviceCert);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    /* ask the server for a ticket, so reconnections can skip the full handshake */
+    mbedtls_ssl_conf_session_tickets(&ctx->config, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
 
-    if (hasClientCert)
+    /* client certificate is parsed once and kept across reconnections */
+    error = TLSTransport_LoadClientCertificate(ctx, Core_GetCrtNvsKey());
+    if (error)
     {
-        ESP_LOGI(TAG, "cloud: loading client certificate...");
-        mbedtls_x509_crt_init(&ctx->clientCertificate);
-
-        error = mbedtls_x509_crt_parse(&ctx->clientCertificate, deviceCert.buffer, 1 + strlen((char *)deviceCert.buffer));
-
-        // DEBUG
-        // error = mbedtls_x509_crt_parse(&ctx->clientCertificate, (uint8_t *)client_crt, 1 + strlen((char *)client_crt));
-
-        free(deviceCert.buffer);
+        PrintError(error, "failed to load client certificate");
+        goto err;
+    }
 
-        if (error)
-        {
-            PrintError(error, "failed to load client certificate");
-            goto err;
-        }
+    bool hasClientCert = ctx->hasClientCertificate;
 
+    if (hasClientCert)
+    {
         ESP_LOGI(TAG, "cloud: loading client private key...");
-        Crypto_GetECCKey(&ctx->privateKey);
+        /* key derivation is puf work, not transport memory */
+        TLSMemory_Pause();
+        error = Crypto_GetECCKey(&ctx->privateKey);
+        TLSMemory_Resume();
 
         if (error)
         {
@@ -180,8 +504,8 @@ ErrorCode TLSTransport_Connect(struct NetworkContext *ctx)
         goto err;
     }
 
-    /* setup network */
-    mbedtls_ssl_set_bio(&ctx->ssl, &ctx->net, mbedtls_net_send, mbedtls_net_recv, mbedtls_net_recv_timeout);
+    /* setup network, non blocking until the handshake is over */
+    mbedtls_ssl_set_bio(&ctx->ssl, &ctx->net, mbedtls_net_send, mbedtls_net_recv, NULL);
     mbedtls_ssl_conf_read_timeout(&ctx->config, 500);
 
     /* setup for SNI */
@@ -195,10 +519,7 @@ ErrorCode TLSTransport_Connect(struct NetworkContext *ctx)
     /* setup certificates */
     if (ctx->rootCaPath)
     {
-        ESP_LOGI(TAG, "cloud: loading SERVER certificate...");
-
-        // error = mbedtls_x509_crt_parse_file(&ctx->rootCertificate, ctx->rootCaPath);
-        error = mbedtls_x509_crt_parse(&ctx->rootCertificate, (unsigned char *)server_cert_pem_start, 1 + strlen((const char *)server_cert_pem_start));
+        error = TLSTransport_LoadRootCertificate(ctx);
         if (error)
         {
             PrintError(error, "failed to load root certificate");
@@ -224,57 +545,172 @@ ErrorCode TLSTransport_Connect(struct NetworkContext *ctx)
         }
     }
 
-    ESP_LOGI(TAG, "transport: connect to %s:%s", ctx->hostname, ctx->port);
-    error = mbedtls_net_connect(&ctx->net, ctx->hostname, ctx->port, MBEDTLS_NET_PROTO_TCP);
-    if (error)
+    /* offer the last session, the server falls back to a full handshake if it rejects it */
+    if (ctx->hasSession)
     {
-        PrintError(error, "failed to connect to endpoint");
-        goto err;
+        error = mbedtls_ssl_set_session(&ctx->ssl, &ctx->session);
+        if (error)
+        {
+            PrintError(error, "failed to set session");
+            TLSTransport_DropSession(ctx);
+        }
     }
 
-    error = mbedtls_ssl_handshake(&ctx->ssl);
+    ESP_LOGI(TAG, "transport: connect to %s:%s", ctx->hostname, ctx->port);
+    error = TLSTransport_StartTcp(ctx);
     if (error)
     {
-        PrintError(error, "failed to handshake");
+        PrintError(error, "failed to connect to endpoint");
         goto err;
     }
 
-    ctx->isConnected = true;
+    ctx->phase = TLS_PHASE_TCP;
+    ctx->connectStartMs = esp_timer_get_time() / 1000;
+    if (TLSTransport_IsInstrumented(ctx))
+        ctx->tcpSpan = TRACE_BEGIN("tcp_connect");
 
     return SUCCESS;
 
 err:
-    mbedtls_ssl_free(&ctx->ssl);
-    mbedtls_ssl_config_free(&ctx->config);
-    mbedtls_x509_crt_free(&ctx->rootCertificate);
-    mbedtls_x509_crt_free(&ctx->clientCertificate);
-    mbedtls_pk_free(&ctx->privateKey);
-    mbedtls_net_free(&ctx->net);
-    mbedtls_ctr_drbg_free(&ctx->ctrDrbg);
-    mbedtls_entropy_free(&ctx->entropy);
+    TLSTransport_Cleanup(ctx);
 
     return FAILURE;
 }
 
+static TLSConnectStatus TLSTransport_ConnectFailure(struct NetworkContext *ctx, int error, const char *reason)
+{
+    PrintError(error, reason);
+    TLSTransport_Cleanup(ctx);
+
+    return TLS_CONNECT_FAILED;
+}
+
+TLSConnectStatus TLSTransport_ConnectStep(struct NetworkContext *ctx, uint32_t waitMs)
+{
+    if (ctx->phase != TLS_PHASE_IDLE && (esp_timer_get_time() / 1000) - ctx->connectStartMs > TLS_CONNECT_TIMEOUT_MS)
+        return TLSTransport_ConnectFailure(ctx, MBEDTLS_ERR_SSL_TIMEOUT, "connection timed out");
+
+    switch (ctx->phase)
+    {
+    case TLS_PHASE_TCP:
+    {
+        if (!TLSTransport_WaitSocket(ctx->net.fd, true, waitMs))
+            return TLS_CONNECT_IN_PROGRESS;
+
+        int socketError = 0;
+        socklen_t length = sizeof(socketError);
+        if (getsockopt(ctx->net.fd, SOL_SOCKET, SO_ERROR, &socketError, &length) != 0 || socketError != 0)
+            return TLSTransport_ConnectFailure(ctx, MBEDTLS_ERR_NET_CONNECT_FAILED, "failed to connect to endpoint");
+
+        ESP_LOGI(TAG, "transport: tcp connected, start handshake");
+        ctx->phase = TLS_PHASE_HANDSHAKE;
+        ctx->handshakeStartMs = esp_timer_get_time() / 1000;
+        if (TLSTransport_IsInstrumented(ctx))
+        {
+            TRACE_END(ctx->tcpSpan);
+            ctx->handshakeSpan = TRACE_BEGIN("tls_handshake");
+        }
+    }
+    /* fall through */
+    case TLS_PHASE_HANDSHAKE:
+    {
+        int error = mbedtls_ssl_handshake(&ctx->ssl);
+        if (TLSTransport_IsInstrumented(ctx))
+            TLSMemory_Sample();
+        if (error == MBEDTLS_ERR_SSL_WANT_READ || error == MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            if (waitMs)
+                TLSTransport_WaitSocket(ctx->net.fd, error == MBEDTLS_ERR_SSL_WANT_WRITE, waitMs);
+            return TLS_CONNECT_IN_PROGRESS;
+        }
+
+        if (error)
+        {
+            /* do not offer the same session on retry */
+            TLSTransport_DropSession(ctx);
+            return TLSTransport_ConnectFailure(ctx, error, "failed to handshake");
+        }
+
+        break;
+    }
+    default:
+        return TLS_CONNECT_FAILED;
+    }
+
+    int64_t handshakeMs = (esp_timer_get_time() / 1000) - ctx->handshakeStartMs;
+    if (TLSTransport_IsInstrumented(ctx))
+        TRACE_END(ctx->handshakeSpan);
+
+    /* keep the negotiated session (and ticket) for next connection, this also tells whether it was resumed */
+    TLSTransport_SaveSession(ctx);
+
+    ESP_LOGI(TAG, "transport: %s handshake in %lld ms", ctx->isResumed ? "resumed" : "full", handshakeMs);
+    if (TLSTransport_IsInstrumented(ctx))
+    {
+        Stats_Observe(STAT_TLS_HANDSHAKE_MS, handshakeMs);
+
+        TLSMemoryStats memoryStats;
+        TLSMemory_GetStats(&memoryStats);
+        if (memoryStats.isHeapEstimate)
+            ESP_LOGI(TAG, "transport: heap %u bytes held by connection, %u bytes peak (estimated from free heap)", memoryStats.used, memoryStats.peak);
+        else
+            ESP_LOGI(TAG, "transport: tls memory %u bytes in use, %u bytes peak", memoryStats.used, memoryStats.peak);
+    }
+
+    /* back to blocking reads bounded by the read timeout */
+    mbedtls_net_set_block(&ctx->net);
+    mbedtls_ssl_set_bio(&ctx->ssl, &ctx->net, mbedtls_net_send, mbedtls_net_recv, mbedtls_net_recv_timeout);
+
+    ctx->phase = TLS_PHASE_IDLE;
+    ctx->isConnected = true;
+
+    return TLS_CONNECT_DONE;
+}
+
+TLSConnectPhase TLSTransport_GetConnectPhase(struct NetworkContext *ctx)
+{
+    return ctx->phase;
+}
+
+bool TLSTransport_HasPendingData(struct NetworkContext *ctx)
+{
+    /* decrypted bytes not read yet, or a record not fully processed */
+    return ctx->isConnected && (mbedtls_ssl_get_bytes_avail(&ctx->ssl) > 0 || mbedtls_ssl_check_pending(&ctx->ssl));
+}
+
+void TLSTransport_SetRecvWait(struct NetworkContext *ctx, uint32_t waitMs)
+{
+    ctx->recvWaitMs = waitMs;
+}
+
+int TLSTransport_GetSocket(struct NetworkContext *ctx)
+{
+    return ctx->isConnected ? ctx->net.fd : -1;
+}
+
+ErrorCode TLSTransport_Connect(struct NetworkContext *ctx)
+{
+    ErrorCode err = TLSTransport_ConnectStart(ctx);
+    if (err)
+        return err;
+
+    TLSConnectStatus status = TLS_CONNECT_IN_PROGRESS;
+    while (status == TLS_CONNECT_IN_PROGRESS)
+        status = TLSTransport_ConnectStep(ctx, TLS_CONNECT_STEP_WAIT_MS);
+
+    return status == TLS_CONNECT_DONE ? SUCCESS : FAILURE;
+}
+
 ErrorCode TLSTransport_Disconnect(struct NetworkContext *ctx, bool force)
 {
-    if (!force)
+    if (!force && ctx->isConnected)
     {
         int error = mbedtls_ssl_close_notify(&ctx->ssl);
         if (error)
             PrintError(error, "failed to close SSL");
     }
 
-    mbedtls_ssl_free(&ctx->ssl);
-    mbedtls_ssl_config_free(&ctx->config);
-    mbedtls_x509_crt_free(&ctx->rootCertificate);
-    mbedtls_x509_crt_free(&ctx->clientCertificate);
-    mbedtls_pk_free(&ctx->privateKey);
-    mbedtls_net_free(&ctx->net);
-    mbedtls_ctr_drbg_free(&ctx->ctrDrbg);
-    mbedtls_entropy_free(&ctx->entropy);
-
-    ctx->isConnected = false;
+    TLSTransport_Cleanup(ctx);
 
     return SUCCESS;
 }
\ No newline at end of file
@@ -8,9 +8,31 @@
 
 struct NetworkContext;
 
+typedef enum TLSConnectPhase
+{
+    TLS_PHASE_IDLE,
+    TLS_PHASE_TCP,
+    TLS_PHASE_HANDSHAKE,
+} TLSConnectPhase;
+
+typedef enum TLSConnectStatus
+{
+    TLS_CONNECT_IN_PROGRESS,
+    TLS_CONNECT_DONE,
+    TLS_CONNECT_FAILED,
+} TLSConnectStatus;
+
 int32_t TLSTransport_Recv(struct NetworkContext *ctx, void *pBuffer, size_t bytesToRecv);
 int32_t TLSTransport_Send(struct NetworkContext *ctx, const void *pBuffer, size_t bytesToSend);
 struct NetworkContext *TLSTransport_Init(const char *hostname, uint16_t port, uint32_t recvTimeout, const char *rootCaPath, const char *clientCertPath, const char *clientKeyPath);
 ErrorCode TLSTransport_Connect(struct NetworkContext *ctx);
+ErrorCode TLSTransport_ConnectStart(struct NetworkContext *ctx);
+TLSConnectStatus TLSTransport_ConnectStep(struct NetworkContext *ctx, uint32_t waitMs);
+TLSConnectPhase TLSTransport_GetConnectPhase(struct NetworkContext *ctx);
+int TLSTransport_GetSocket(struct NetworkContext *ctx);
+bool TLSTransport_HasPendingData(struct NetworkContext *ctx);
+void TLSTransport_SetRecvWait(struct NetworkContext *ctx, uint32_t waitMs);
 ErrorCode TLSTransport_Disconnect(struct NetworkContext *ctx, bool force);
+void TLSTransport_InvalidateCredentials(struct NetworkContext *ctx);
+void TLSTransport_DisableSessionCache(struct NetworkContext *ctx);
 void TLSTransport_Free(struct NetworkContext *ctx);
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "net/topic_router.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#define TOPIC_ROUTER_NO_NODE 0xFF
+
+static const char *TAG = "TopicRouter";
+
+typedef struct TopicNode
+{
+    char level[TOPIC_ROUTER_MAX_LEVEL_LEN];
+    uint8_t levelLength;
+    uint8_t firstChild;
+    uint8_t nextSibling;
+    uint8_t wildcardChild;       /* '+' */
+    TopicHandler handler;        /* filter ends at this node */
+    TopicHandler subtreeHandler; /* '#' below this node */
+} TopicNode;
+
+/* node 0 is the root, it has no level */
+static TopicNode router_nodes[TOPIC_ROUTER_MAX_NODES] = {
+    [0] = {.firstChild = TOPIC_ROUTER_NO_NODE, .nextSibling = TOPIC_ROUTER_NO_NODE, .wildcardChild = TOPIC_ROUTER_NO_NODE},
+};
+static size_t router_nodesCount = 1;
+
+static size_t TopicRouter_LevelEnd(CString topic, size_t start)
+{
+    const char *separator = memchr(topic.string + start, '/', topic.length - start);
+    return separator ? (size_t)(separator - topic.string) : topic.length;
+}
+
+static uint8_t TopicRouter_FindChild(uint8_t parent, const char *level, size_t levelLength)
+{
+    for (uint8_t child = router_nodes[parent].firstChild; child != TOPIC_ROUTER_NO_NODE; child = router_nodes[child].nextSibling)
+    {
+        if (router_nodes[child].levelLength == levelLength && memcmp(router_nodes[child].level, level, levelLength) == 0)
+            return child;
+    }
+
+    return TOPIC_ROUTER_NO_NODE;
+}
+
+static uint8_t TopicRouter_AddChild(uint8_t parent, const char *level, size_t levelLength)
+{
+    if (router_nodesCount >= TOPIC_ROUTER_MAX_NODES || levelLength >= TOPIC_ROUTER_MAX_LEVEL_LEN)
+        return TOPIC_ROUTER_NO_NODE;
+
+    uint8_t index = router_nodesCount++;
+    TopicNode *node = &router_nodes[index];
+
+    memset(node, 0, sizeof(TopicNode));
+    memcpy(node->level, level, levelLength);
+    node->levelLength = levelLength;
+    node->firstChild = TOPIC_ROUTER_NO_NODE;
+    node->wildcardChild = TOPIC_ROUTER_NO_NODE;
+
+    bool isWildcard = levelLength == 1 && level[0] == '+';
+    if (isWildcard)
+    {
+        node->nextSibling = TOPIC_ROUTER_NO_NODE;
+        router_nodes[parent].wildcardChild = index;
+    }
+    else
+    {
+        node->nextSibling = router_nodes[parent].firstChild;
+        router_nodes[parent].firstChild = index;
+    }
+
+    return index;
+}
+
+bool TopicRouter_IsValidFilter(CString filter)
+{
+    if (filter.length == 0 || memchr(filter.string, '\0', filter.length))
+        return false;
+
+    /* wildcards fill a whole level, '#' only the last one */
+    for (size_t i = 0; i < filter.length; i++)
+    {
+        char c = filter.string[i];
+        if (c != '+' && c != '#')
+            continue;
+
+        bool isLevelStart = i == 0 || filter.string[i - 1] == '/';
+        bool isLevelEnd = i + 1 == filter.length || filter.string[i + 1] == '/';
+        if (!isLevelStart || !isLevelEnd || (c == '#' && i + 1 != filter.length))
+            return false;
+    }
+
+    return true;
+}
+
+ErrorCode TopicRouter_Register(CString filter, TopicHandler handler)
+{
+    uint8_t node = 0;
+    size_t start = 0;
+
+    if (!TopicRouter_IsValidFilter(filter))
+    {
+        ESP_LOGE(TAG, "invalid filter %.*s", (int)filter.length, filter.string);
+        return FAILURE;
+    }
+
+    while (true)
+    {
+        size_t end = TopicRouter_LevelEnd(filter, start);
+        const char *level = filter.string + start;
+        size_t levelLength = end - start;
+
+        if (levelLength == 1 && level[0] == '#')
+        {
+            if (router_nodes[node].subtreeHandler)
+                return FAILURE;
+
+            router_nodes[node].subtreeHandler = handler;
+            return SUCCESS;
+        }
+
+        uint8_t child = (levelLength == 1 && level[0] == '+') ? router_nodes[node].wildcardChild : TopicRouter_FindChild(node, level, levelLength);
+        if (child == TOPIC_ROUTER_NO_NODE)
+            child = TopicRouter_AddChild(node, level, levelLength);
+
+        if (child == TOPIC_ROUTER_NO_NODE)
+        {
+            ESP_LOGE(TAG, "no room for filter %.*s", (int)filter.length, filter.string);
+            return FAILURE;
+        }
+
+        node = child;
+
+        if (end == filter.length)
+            break;
+
+        start = end + 1;
+    }
+
+    if (router_nodes[node].handler)
+        return FAILURE;
+
+    router_nodes[node].handler = handler;
+    return SUCCESS;
+}
+
+static size_t TopicRouter_Match(uint8_t node, CString topic, size_t start, CBuffer payload)
+{
+    size_t matches = 0;
+
+    /* topics starting with '$' are not matched by wildcards at the first level */
+    bool allowWildcards = node != 0 || topic.length == 0 || topic.string[0] != '$';
+
+    if (allowWildcards && router_nodes[node].subtreeHandler)
+    {
+        router_nodes[node].subtreeHandler(topic, payload);
+        matches++;
+    }
+
+    if (start > topic.length)
+    {
+        if (router_nodes[node].handler)
+        {
+            router_nodes[node].handler(topic, payload);
+            matches++;
+        }
+        return matches;
+    }
+
+    size_t end = TopicRouter_LevelEnd(topic, start);
+
+    uint8_t child = TopicRouter_FindChild(node, topic.string + start, end - start);
+    if (child != TOPIC_ROUTER_NO_NODE)
+        matches += TopicRouter_Match(child, topic, end + 1, payload);
+
+    if (allowWildcards && router_nodes[node].wildcardChild != TOPIC_ROUTER_NO_NODE)
+        matches += TopicRouter_Match(router_nodes[node].wildcardChild, topic, end + 1, payload);
+
+    return matches;
+}
+
+size_t TopicRouter_Dispatch(CString topic, CBuffer payload)
+{
+    return TopicRouter_Match(0, topic, 0, payload);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core/error.h"
+#include "define.h"
+
+/* trie of registered topic filters, one node per topic level */
+#define TOPIC_ROUTER_MAX_NODES 32
+#define TOPIC_ROUTER_MAX_LEVEL_LEN 32
+
+typedef void (*TopicHandler)(CString topic, CBuffer payload);
+
+bool TopicRouter_IsValidFilter(CString filter);
+ErrorCode TopicRouter_Register(CString filter, TopicHandler handler);
+size_t TopicRouter_Dispatch(CString topic, CBuffer payload);
@@ -31,6 +31,7 @@ static void Wifi_EventHandler(void *arg, esp_event_base_t event_base, int32_t ev
             break;
         case WIFI_EVENT_STA_DISCONNECTED:
             ESP_LOGI(TAG, "connection failure");
+            Core_EventNotify(CORE_EVENT_DISCONNECTED);
             if (connection_retry_count < ESP_MAXIMUM_RETRY)
             {
                 connection_retry_count += 1;
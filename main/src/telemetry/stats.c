@@ -0,0 +1,244 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "telemetry/stats.h"
+#include "core/cbor.h"
+
+typedef struct StatDefinition
+{
+    const char *name;
+    StatType type;
+} StatDefinition;
+
+static const StatDefinition stats_definitions[STAT_COUNT] = {
+    [STAT_PUF_ATTEMPTS] = {"puf_attempts", STAT_TYPE_COUNTER},
+    [STAT_PUF_FAILURES] = {"puf_failures", STAT_TYPE_COUNTER},
+    [STAT_DECODE_ERRORS] = {"decode_errors", STAT_TYPE_COUNTER},
+    [STAT_NVS_READ_US] = {"nvs_read_us", STAT_TYPE_HISTOGRAM},
+    [STAT_NVS_WRITE_US] = {"nvs_write_us", STAT_TYPE_HISTOGRAM},
+    [STAT_TLS_HANDSHAKE_MS] = {"tls_handshake_ms", STAT_TYPE_HISTOGRAM},
+    [STAT_CLOUD_CONNECT_MS] = {"cloud_connect_ms", STAT_TYPE_HISTOGRAM},
+    [STAT_CLOUD_CONNECT_LAST_MS] = {"cloud_connect_last_ms", STAT_TYPE_GAUGE},
+    [STAT_CONNECT_ATTEMPTS] = {"connect_attempts", STAT_TYPE_COUNTER},
+    [STAT_CONNECT_FAILURES] = {"connect_failures", STAT_TYPE_COUNTER},
+    [STAT_LINK_LOSSES] = {"link_losses", STAT_TYPE_COUNTER},
+    [STAT_KEEPALIVE_MISSES] = {"keepalive_misses", STAT_TYPE_COUNTER},
+    [STAT_LINK_HEALTH] = {"link_health", STAT_TYPE_GAUGE},
+    [STAT_CONNECT_BACKOFF_MS] = {"connect_backoff_ms", STAT_TYPE_GAUGE},
+    [STAT_RECONNECTS] = {"reconnects", STAT_TYPE_COUNTER},
+    [STAT_PUBLISH_COUNT] = {"publish_count", STAT_TYPE_COUNTER},
+    [STAT_PUBLISH_BYTES] = {"publish_bytes", STAT_TYPE_COUNTER},
+    [STAT_PUBLISH_FAILURES] = {"publish_failures", STAT_TYPE_COUNTER},
+    [STAT_HEAP_FREE] = {"heap_free", STAT_TYPE_GAUGE},
+    [STAT_HEAP_LOW_WATER] = {"heap_low_water", STAT_TYPE_GAUGE},
+    [STAT_CORE_STACK_LOW_WATER] = {"core_stack_low_water", STAT_TYPE_GAUGE},
+    [STAT_CORE_EVENT_LATENCY_US] = {"core_event_latency_us", STAT_TYPE_HISTOGRAM},
+};
+
+typedef struct StatSlot
+{
+    atomic_uint_least32_t value; /* counter, gauge or histogram count */
+    atomic_uint_least32_t sum;
+    atomic_uint_least32_t max;
+    atomic_uint_least32_t buckets[STATS_HISTOGRAM_BUCKETS];
+} StatSlot;
+
+static StatSlot stats_slots[STAT_COUNT] = {0};
+
+void Stats_Add(StatId id, uint32_t value)
+{
+    atomic_fetch_add_explicit(&stats_slots[id].value, value, memory_order_relaxed);
+}
+
+void Stats_Increment(StatId id)
+{
+    Stats_Add(id, 1);
+}
+
+void Stats_SetGauge(StatId id, int32_t value)
+{
+    atomic_store_explicit(&stats_slots[id].value, (uint32_t)value, memory_order_relaxed);
+}
+
+static size_t Stats_GetBucket(uint32_t value)
+{
+    if (value < 2)
+        return 0;
+
+    return MIN((size_t)(31 - __builtin_clz(value)), STATS_HISTOGRAM_BUCKETS - 1);
+}
+
+void Stats_Observe(StatId id, uint32_t value)
+{
+    StatSlot *slot = &stats_slots[id];
+
+    atomic_fetch_add_explicit(&slot->buckets[Stats_GetBucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->value, 1, memory_order_relaxed);
+
+    uint_least32_t max = atomic_load_explicit(&slot->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&slot->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void Stats_SampleHeap(void)
+{
+    Stats_SetGauge(STAT_HEAP_FREE, esp_get_free_heap_size());
+    Stats_SetGauge(STAT_HEAP_LOW_WATER, esp_get_minimum_free_heap_size());
+}
+
+void Stats_SampleCoreStack(void)
+{
+    /* watermark of the calling task */
+    Stats_SetGauge(STAT_CORE_STACK_LOW_WATER, uxTaskGetStackHighWaterMark(NULL));
+}
+
+static uint32_t Stats_GetPercentile(const uint32_t *buckets, uint32_t count, uint32_t max, uint32_t percent)
+{
+    uint32_t rank = (count * percent + 99) / 100;
+    uint32_t seen = 0;
+
+    for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return MIN((uint32_t)((2u << i) - 1), max);
+    }
+
+    return max;
+}
+
+void Stats_Get(StatId id, StatSnapshot *outSnapshot)
+{
+    StatSlot *slot = &stats_slots[id];
+
+    outSnapshot->name = stats_definitions[id].name;
+    outSnapshot->type = stats_definitions[id].type;
+
+    switch (outSnapshot->type)
+    {
+    case STAT_TYPE_COUNTER:
+        outSnapshot->counter = atomic_load_explicit(&slot->value, memory_order_relaxed);
+        break;
+    case STAT_TYPE_GAUGE:
+        outSnapshot->gauge = (int32_t)atomic_load_explicit(&slot->value, memory_order_relaxed);
+        break;
+    case STAT_TYPE_HISTOGRAM:
+    {
+        /* fields are read one by one, a concurrent observation may be half counted */
+        uint32_t buckets[STATS_HISTOGRAM_BUCKETS];
+        uint32_t count = 0;
+        for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+        {
+            buckets[i] = atomic_load_explicit(&slot->buckets[i], memory_order_relaxed);
+            count += buckets[i];
+        }
+
+        StatHistogram *histogram = &outSnapshot->histogram;
+        histogram->count = count;
+        histogram->sum = atomic_load_explicit(&slot->sum, memory_order_relaxed);
+        histogram->max = atomic_load_explicit(&slot->max, memory_order_relaxed);
+        histogram->p50 = Stats_GetPercentile(buckets, count, histogram->max, 50);
+        histogram->p99 = Stats_GetPercentile(buckets, count, histogram->max, 99);
+    }
+    break;
+    }
+}
+
+void Stats_Reset(void)
+{
+    for (size_t id = 0; id < STAT_COUNT; id++)
+    {
+        /* gauges keep their last sample */
+        if (stats_definitions[id].type == STAT_TYPE_GAUGE)
+            continue;
+
+        StatSlot *slot = &stats_slots[id];
+        atomic_store(&slot->value, 0);
+        atomic_store(&slot->sum, 0);
+        atomic_store(&slot->max, 0);
+        for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+            atomic_store(&slot->buckets[i], 0);
+    }
+}
+
+size_t Stats_Encode(char *out, size_t outSize)
+{
+    /* {"<counter>":<n>,"<gauge>":<n>,"<histogram>":[<count>,<sum>,<max>,<p50>,<p99>],...} */
+    size_t length = snprintf(out, outSize, "{");
+
+    for (size_t id = 0; id < STAT_COUNT && length < outSize; id++)
+    {
+        StatSnapshot snapshot;
+        Stats_Get(id, &snapshot);
+
+        const char *separator = id ? "," : "";
+        switch (snapshot.type)
+        {
+        case STAT_TYPE_COUNTER:
+            length += snprintf(out + length, outSize - length, "%s\"%s\":%lu", separator, snapshot.name, (unsigned long)snapshot.counter);
+            break;
+        case STAT_TYPE_GAUGE:
+            length += snprintf(out + length, outSize - length, "%s\"%s\":%ld", separator, snapshot.name, (long)snapshot.gauge);
+            break;
+        case STAT_TYPE_HISTOGRAM:
+            length += snprintf(out + length, outSize - length, "%s\"%s\":[%lu,%lu,%lu,%lu,%lu]", separator, snapshot.name,
+                               (unsigned long)snapshot.histogram.count, (unsigned long)snapshot.histogram.sum, (unsigned long)snapshot.histogram.max,
+                               (unsigned long)snapshot.histogram.p50, (unsigned long)snapshot.histogram.p99);
+            break;
+        }
+    }
+
+    if (length < outSize)
+        length += snprintf(out + length, outSize - length, "}");
+
+    /* truncated */
+    if (length >= outSize)
+        return 0;
+
+    return length;
+}
+
+size_t Stats_EncodeCbor(uint8_t *out, size_t outSize)
+{
+    /* same layout as the json object */
+    CborWriter writer;
+    Cbor_WriterInit(&writer, out, outSize);
+
+    Cbor_WriteMap(&writer, STAT_COUNT);
+    for (size_t id = 0; id < STAT_COUNT; id++)
+    {
+        StatSnapshot snapshot;
+        Stats_Get(id, &snapshot);
+
+        Cbor_WriteText(&writer, snapshot.name, strlen(snapshot.name));
+        switch (snapshot.type)
+        {
+        case STAT_TYPE_COUNTER:
+            Cbor_WriteUint(&writer, snapshot.counter);
+            break;
+        case STAT_TYPE_GAUGE:
+            Cbor_WriteInt(&writer, snapshot.gauge);
+            break;
+        case STAT_TYPE_HISTOGRAM:
+            Cbor_WriteArray(&writer, 5);
+            Cbor_WriteUint(&writer, snapshot.histogram.count);
+            Cbor_WriteUint(&writer, snapshot.histogram.sum);
+            Cbor_WriteUint(&writer, snapshot.histogram.max);
+            Cbor_WriteUint(&writer, snapshot.histogram.p50);
+            Cbor_WriteUint(&writer, snapshot.histogram.p99);
+            break;
+        }
+    }
+
+    CBuffer encoded;
+    if (Cbor_WriterFinish(&writer, &encoded))
+        return 0;
+
+    return encoded.length;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/error.h"
+#include "define.h"
+
+#define STATS_PUBLISH_PERIOD_MS CONFIG_STATS_PUBLISH_PERIOD_MS
+
+/* histogram bucket i counts values below 2^(i+1), the last one everything above */
+#define STATS_HISTOGRAM_BUCKETS 20
+
+#define STATS_BUFFER_SIZE 1024
+
+typedef enum StatType
+{
+    STAT_TYPE_COUNTER,
+    STAT_TYPE_GAUGE,
+    STAT_TYPE_HISTOGRAM,
+} StatType;
+
+/* every statistic is known at build time, its slot is its id */
+typedef enum StatId
+{
+    STAT_PUF_ATTEMPTS,
+    STAT_PUF_FAILURES,
+    STAT_DECODE_ERRORS,
+    STAT_NVS_READ_US,
+    STAT_NVS_WRITE_US,
+    STAT_TLS_HANDSHAKE_MS,
+    STAT_CLOUD_CONNECT_MS,
+    STAT_CLOUD_CONNECT_LAST_MS,
+    STAT_CONNECT_ATTEMPTS,
+    STAT_CONNECT_FAILURES,
+    STAT_LINK_LOSSES,
+    STAT_KEEPALIVE_MISSES,
+    STAT_LINK_HEALTH,
+    STAT_CONNECT_BACKOFF_MS,
+    STAT_RECONNECTS,
+    STAT_PUBLISH_COUNT,
+    STAT_PUBLISH_BYTES,
+    STAT_PUBLISH_FAILURES,
+    STAT_HEAP_FREE,
+    STAT_HEAP_LOW_WATER,
+    STAT_CORE_STACK_LOW_WATER,
+    STAT_CORE_EVENT_LATENCY_US,
+    STAT_COUNT,
+} StatId;
+
+typedef struct StatHistogram
+{
+    uint32_t count;
+    uint32_t sum;
+    uint32_t max;
+    uint32_t p50; /* upper bound of the bucket holding the percentile */
+    uint32_t p99;
+} StatHistogram;
+
+typedef struct StatSnapshot
+{
+    const char *name;
+    StatType type;
+    union
+    {
+        uint32_t counter;
+        int32_t gauge;
+        StatHistogram histogram;
+    };
+} StatSnapshot;
+
+/* safe from any task, updates are lock-free */
+void Stats_Add(StatId id, uint32_t value);
+void Stats_Increment(StatId id);
+void Stats_SetGauge(StatId id, int32_t value);
+void Stats_Observe(StatId id, uint32_t value);
+
+/* refreshes the heap gauges, safe from any task */
+void Stats_SampleHeap(void);
+/* refreshes the core stack gauge, called by the core task only */
+void Stats_SampleCoreStack(void);
+
+void Stats_Get(StatId id, StatSnapshot *outSnapshot);
+void Stats_Reset(void);
+size_t Stats_Encode(char *out, size_t outSize);
+size_t Stats_EncodeCbor(uint8_t *out, size_t outSize);
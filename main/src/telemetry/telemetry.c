@@ -0,0 +1,108 @@
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "telemetry/telemetry.h"
+
+#define TELEMETRY_TASK_STACK_SIZE 3072
+
+static const char *TAG = "Telemetry";
+
+static const TelemetrySource *telemetry_sources[TELEMETRY_MAX_SOURCES];
+static size_t telemetry_sourcesCount = 0;
+
+static TelemetryRing telemetry_ring = {0};
+
+static ErrorCode Telemetry_ReadHeap(void *ctx, float *value)
+{
+    (void)ctx;
+    *value = (float)esp_get_free_heap_size();
+    return SUCCESS;
+}
+
+const TelemetrySource Telemetry_HeapSource = {
+    .name = "heap",
+    .read = Telemetry_ReadHeap,
+    .ctx = NULL,
+};
+
+size_t Telemetry_Peek(TelemetrySample *samples, size_t maxSamples)
+{
+    return TelemetryRing_Peek(&telemetry_ring, samples, maxSamples);
+}
+
+void Telemetry_Consume(size_t count)
+{
+    TelemetryRing_Consume(&telemetry_ring, count);
+}
+
+size_t Telemetry_GetPendingCount(void)
+{
+    return TelemetryRing_GetPendingCount(&telemetry_ring);
+}
+
+uint32_t Telemetry_GetDroppedCount(void)
+{
+    return TelemetryRing_GetDroppedCount(&telemetry_ring);
+}
+
+ErrorCode Telemetry_RegisterSource(const TelemetrySource *source)
+{
+    if (telemetry_sourcesCount >= TELEMETRY_MAX_SOURCES)
+        return FAILURE;
+
+    telemetry_sources[telemetry_sourcesCount++] = source;
+    return SUCCESS;
+}
+
+void Telemetry_Sample(uint32_t timestampMs)
+{
+    for (size_t i = 0; i < telemetry_sourcesCount; i++)
+    {
+        TelemetrySample sample = {.timestampMs = timestampMs, .sourceId = i};
+        if (telemetry_sources[i]->read(telemetry_sources[i]->ctx, &sample.value))
+        {
+            ESP_LOGW(TAG, "failed to read %s", telemetry_sources[i]->name);
+            continue;
+        }
+
+        TelemetryRing_Push(&telemetry_ring, &sample);
+    }
+}
+
+size_t Telemetry_EncodeBatch(const TelemetrySample *samples, size_t count, char *out, size_t outSize)
+{
+    return TelemetryBatch_Encode(telemetry_sources, telemetry_sourcesCount, samples, count, out, outSize);
+}
+
+size_t Telemetry_EncodeBatchCbor(const TelemetrySample *samples, size_t count, uint8_t *out, size_t outSize)
+{
+    return TelemetryBatch_EncodeCbor(telemetry_sources, telemetry_sourcesCount, samples, count, out, outSize);
+}
+
+static uint32_t Telemetry_GetTimeMs(void)
+{
+    return (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+
+static void Telemetry_TaskMain(void *pvParameters)
+{
+    TickType_t lastWake = xTaskGetTickCount();
+
+    while (true)
+    {
+        Telemetry_Sample(Telemetry_GetTimeMs());
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(TELEMETRY_SAMPLE_PERIOD_MS));
+    }
+}
+
+ErrorCode Telemetry_Start(void)
+{
+    ESP_LOGI(TAG, "sampling %u sources every %u ms", telemetry_sourcesCount, TELEMETRY_SAMPLE_PERIOD_MS);
+
+    if (xTaskCreate(Telemetry_TaskMain, "telemetry_task", TELEMETRY_TASK_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS)
+        return FAILURE;
+
+    return SUCCESS;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "core/error.h"
+#include "define.h"
+#include "telemetry/telemetry_batch.h"
+
+#define TELEMETRY_SAMPLE_PERIOD_MS CONFIG_TELEMETRY_SAMPLE_PERIOD_MS
+#define TELEMETRY_PUBLISH_PERIOD_MS CONFIG_TELEMETRY_PUBLISH_PERIOD_MS
+
+#define TELEMETRY_MAX_SOURCES 4
+
+/* samples packed in a single publish */
+#define TELEMETRY_BATCH_MAX_SAMPLES 64
+#define TELEMETRY_BATCH_BUFFER_SIZE 2048
+
+/* free heap in bytes */
+extern const TelemetrySource Telemetry_HeapSource;
+
+ErrorCode Telemetry_RegisterSource(const TelemetrySource *source);
+ErrorCode Telemetry_Start(void);
+void Telemetry_Sample(uint32_t timestampMs);
+/* samples stay queued until consumed, so a failed publish does not lose them */
+size_t Telemetry_Peek(TelemetrySample *samples, size_t maxSamples);
+void Telemetry_Consume(size_t count);
+size_t Telemetry_GetPendingCount(void);
+uint32_t Telemetry_GetDroppedCount(void);
+size_t Telemetry_EncodeBatch(const TelemetrySample *samples, size_t count, char *out, size_t outSize);
+size_t Telemetry_EncodeBatchCbor(const TelemetrySample *samples, size_t count, uint8_t *out, size_t outSize);
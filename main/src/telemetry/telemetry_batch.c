@@ -0,0 +1,132 @@
+#include <sys/param.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemetry/telemetry_batch.h"
+#include "core/cbor.h"
+
+static ErrorCode Telemetry_ReadSynthetic(void *ctx, float *value)
+{
+    uint32_t *counter = (uint32_t *)ctx;
+    *value = 12.8f + 0.1f * (float)((int32_t)(*counter % 20) - 10);
+    (*counter)++;
+    return SUCCESS;
+}
+
+static uint32_t telemetry_syntheticCounter = 0;
+
+const TelemetrySource Telemetry_SyntheticSource = {
+    .name = "temp",
+    .read = Telemetry_ReadSynthetic,
+    .ctx = &telemetry_syntheticCounter,
+};
+
+bool TelemetryRing_Push(TelemetryRing *ring, const TelemetrySample *sample)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail == TELEMETRY_RING_SIZE)
+    {
+        /* full, keep the older samples and count the loss */
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    ring->samples[head & (TELEMETRY_RING_SIZE - 1)] = *sample;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+size_t TelemetryRing_Peek(TelemetryRing *ring, TelemetrySample *samples, size_t maxSamples)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    size_t count = MIN(head - tail, maxSamples);
+    for (size_t i = 0; i < count; i++)
+        samples[i] = ring->samples[(tail + i) & (TELEMETRY_RING_SIZE - 1)];
+
+    return count;
+}
+
+void TelemetryRing_Consume(TelemetryRing *ring, size_t count)
+{
+    /* the producer cannot overwrite peeked samples until the tail moves */
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+size_t TelemetryRing_GetPendingCount(TelemetryRing *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+uint32_t TelemetryRing_GetDroppedCount(TelemetryRing *ring)
+{
+    return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
+
+size_t TelemetryBatch_Encode(const TelemetrySource *const *sources, size_t sourceCount, const TelemetrySample *samples, size_t count, char *out, size_t outSize)
+{
+    /* {"t0":<ms>,"src":["temp",...],"s":[[<dt>,<src>,<value>],...]} */
+    uint32_t t0 = count > 0 ? samples[0].timestampMs : 0;
+    size_t length = snprintf(out, outSize, "{\"t0\":%lu,\"src\":[", (unsigned long)t0);
+
+    for (size_t i = 0; i < sourceCount && length < outSize; i++)
+        length += snprintf(out + length, outSize - length, "%s\"%s\"", i ? "," : "", sources[i]->name);
+
+    if (length < outSize)
+        length += snprintf(out + length, outSize - length, "],\"s\":[");
+
+    for (size_t i = 0; i < count && length < outSize; i++)
+    {
+        length += snprintf(out + length, outSize - length, "%s[%lu,%u,%.6g]", i ? "," : "",
+                           (unsigned long)(samples[i].timestampMs - t0), samples[i].sourceId, samples[i].value);
+    }
+
+    if (length < outSize)
+        length += snprintf(out + length, outSize - length, "]}");
+
+    /* truncated */
+    if (length >= outSize)
+        return 0;
+
+    return length;
+}
+
+size_t TelemetryBatch_EncodeCbor(const TelemetrySource *const *sources, size_t sourceCount, const TelemetrySample *samples, size_t count, uint8_t *out, size_t outSize)
+{
+    /* same layout as the json batch, values as float32 */
+    CborWriter writer;
+    Cbor_WriterInit(&writer, out, outSize);
+
+    uint32_t t0 = count > 0 ? samples[0].timestampMs : 0;
+    Cbor_WriteMap(&writer, 3);
+
+    Cbor_WriteText(&writer, "t0", 2);
+    Cbor_WriteUint(&writer, t0);
+
+    Cbor_WriteText(&writer, "src", 3);
+    Cbor_WriteArray(&writer, sourceCount);
+    for (size_t i = 0; i < sourceCount; i++)
+        Cbor_WriteText(&writer, sources[i]->name, strlen(sources[i]->name));
+
+    Cbor_WriteText(&writer, "s", 1);
+    Cbor_WriteArray(&writer, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Cbor_WriteArray(&writer, 3);
+        Cbor_WriteUint(&writer, samples[i].timestampMs - t0);
+        Cbor_WriteUint(&writer, samples[i].sourceId);
+        Cbor_WriteFloat(&writer, samples[i].value);
+    }
+
+    CBuffer encoded;
+    if (Cbor_WriterFinish(&writer, &encoded))
+        return 0;
+
+    return encoded.length;
+}
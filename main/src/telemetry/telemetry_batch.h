@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/error.h"
+#include "define.h"
+
+/* sample ring and batch encoding, free of FreeRTOS so they build on the host */
+
+/* ring capacity, must be a power of two */
+#define TELEMETRY_RING_SIZE 128
+
+typedef struct TelemetrySample
+{
+    uint32_t timestampMs;
+    uint8_t sourceId;
+    float value;
+} TelemetrySample;
+
+typedef struct TelemetrySource
+{
+    const char *name;
+    ErrorCode (*read)(void *ctx, float *value);
+    void *ctx;
+} TelemetrySource;
+
+/* single producer (sampling task), single consumer (core task) */
+typedef struct TelemetryRing
+{
+    TelemetrySample samples[TELEMETRY_RING_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_uint_least32_t dropped;
+} TelemetryRing;
+
+/* deterministic sawtooth around a fixed temperature */
+extern const TelemetrySource Telemetry_SyntheticSource;
+
+bool TelemetryRing_Push(TelemetryRing *ring, const TelemetrySample *sample);
+/* copies the oldest samples without removing them, TelemetryRing_Consume removes them once sent */
+size_t TelemetryRing_Peek(TelemetryRing *ring, TelemetrySample *samples, size_t maxSamples);
+void TelemetryRing_Consume(TelemetryRing *ring, size_t count);
+size_t TelemetryRing_GetPendingCount(TelemetryRing *ring);
+uint32_t TelemetryRing_GetDroppedCount(TelemetryRing *ring);
+
+size_t TelemetryBatch_Encode(const TelemetrySource *const *sources, size_t sourceCount, const TelemetrySample *samples, size_t count, char *out, size_t outSize);
+size_t TelemetryBatch_EncodeCbor(const TelemetrySource *const *sources, size_t sourceCount, const TelemetrySample *samples, size_t count, uint8_t *out, size_t outSize);
@@ -0,0 +1,11 @@
+#pragma once
+
+/* host build of esp_check.h */
+
+#define ESP_RETURN_ON_ERROR(x, log_tag, format, ...) \
+    do                                               \
+    {                                                \
+        esp_err_t err_rc_ = (x);                     \
+        if (err_rc_ != ESP_OK)                       \
+            return err_rc_;                          \
+    } while (0)
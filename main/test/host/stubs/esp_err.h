@@ -0,0 +1,8 @@
+#pragma once
+
+/* host build of esp_err.h, only what the portable modules use */
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
@@ -0,0 +1,143 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "core/cbor.h"
+
+#define BUFFER(...) ((CBuffer){.buffer = (const uint8_t[]){__VA_ARGS__}, .length = sizeof((const uint8_t[]){__VA_ARGS__})})
+
+static ErrorCode Skip(CBuffer data, size_t *outOffset)
+{
+    CborReader reader;
+    Cbor_ReaderInit(&reader, data);
+    ErrorCode err = Cbor_SkipItem(&reader);
+    if (outOffset)
+        *outOffset = reader.offset;
+    return err;
+}
+
+static void Test_RoundTrip(void)
+{
+    uint8_t out[64];
+    CborWriter writer;
+    Cbor_WriterInit(&writer, out, sizeof(out));
+    Cbor_WriteMap(&writer, 3);
+    Cbor_WriteText(&writer, "a", 1);
+    Cbor_WriteUint(&writer, 70000);
+    Cbor_WriteText(&writer, "b", 1);
+    Cbor_WriteArray(&writer, 2);
+    Cbor_WriteInt(&writer, -5);
+    Cbor_WriteBytes(&writer, (const uint8_t *)"xy", 2);
+    Cbor_WriteText(&writer, "c", 1);
+    Cbor_WriteText(&writer, "hello", 5);
+
+    CBuffer encoded;
+    assert(Cbor_WriterFinish(&writer, &encoded) == SUCCESS);
+
+    CborItem item;
+    assert(Cbor_MapFind(encoded, "a", &item) == SUCCESS && item.type == CBOR_TYPE_UINT && item.value == 70000);
+    assert(Cbor_MapFind(encoded, "c", &item) == SUCCESS && item.type == CBOR_TYPE_TEXT && item.value == 5);
+    assert(memcmp(item.data, "hello", 5) == 0);
+    assert(Cbor_MapFind(encoded, "missing", &item) == FAILURE);
+
+    size_t offset = 0;
+    assert(Skip(encoded, &offset) == SUCCESS && offset == encoded.length);
+}
+
+static void Test_TruncatedItems(void)
+{
+    CborItem item;
+
+    /* empty input */
+    assert(Skip((CBuffer){.buffer = NULL, .length = 0}, NULL) == FAILURE);
+
+    /* uint16 argument with one byte missing */
+    assert(Skip(BUFFER(0x19, 0x01), NULL) == FAILURE);
+
+    /* text of 5 bytes with only 2 present */
+    assert(Skip(BUFFER(0x65, 'h', 'e'), NULL) == FAILURE);
+
+    /* array of 3 with 2 elements */
+    assert(Skip(BUFFER(0x83, 0x01, 0x02), NULL) == FAILURE);
+
+    /* map whose last value is missing, the key is found but not its value */
+    assert(Cbor_MapFind(BUFFER(0xA1, 0x61, 'k'), "k", &item) == FAILURE);
+
+    /* map that ends before the searched key */
+    assert(Cbor_MapFind(BUFFER(0xA2, 0x61, 'a', 0x01), "b", &item) == FAILURE);
+}
+
+static void Test_OversizedLengths(void)
+{
+    CborItem item;
+
+    /* byte string claiming 2^32 bytes */
+    assert(Skip(BUFFER(0x5A, 0xFF, 0xFF, 0xFF, 0xFF, 0x00), NULL) == FAILURE);
+
+    /* text claiming 2^64 - 1 bytes, must not wrap the offset */
+    assert(Skip(BUFFER(0x7B, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 'a'), NULL) == FAILURE);
+
+    /* array and map counts far beyond the input */
+    assert(Skip(BUFFER(0x9A, 0xFF, 0xFF, 0xFF, 0xFF, 0x01), NULL) == FAILURE);
+    assert(Cbor_MapFind(BUFFER(0xBB, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x61, 'a', 0x01), "b", &item) == FAILURE);
+
+    /* reserved additional information */
+    assert(Skip(BUFFER(0x1C), NULL) == FAILURE);
+}
+
+static void Test_NestingDepth(void)
+{
+    uint8_t nested[16];
+
+    /* arrays of one element down to a uint at depth 8 are accepted */
+    memset(nested, 0x81, 8);
+    nested[8] = 0x00;
+    assert(Skip((CBuffer){.buffer = nested, .length = 9}, NULL) == SUCCESS);
+
+    /* one more level is rejected */
+    memset(nested, 0x81, 9);
+    nested[9] = 0x00;
+    assert(Skip((CBuffer){.buffer = nested, .length = 10}, NULL) == FAILURE);
+
+    /* the same limit applies to values skipped by a map lookup */
+    uint8_t map[20] = {0xA2, 0x61, 'a'};
+    memset(&map[3], 0x81, 9);
+    map[12] = 0x00;
+    map[13] = 0x61;
+    map[14] = 'b';
+    map[15] = 0x01;
+    CborItem item;
+    assert(Cbor_MapFind((CBuffer){.buffer = map, .length = 16}, "b", &item) == FAILURE);
+    map[3] = 0x00;
+    memmove(&map[4], &map[13], 3);
+    assert(Cbor_MapFind((CBuffer){.buffer = map, .length = 7}, "b", &item) == SUCCESS && item.value == 1);
+}
+
+static void Test_IndefiniteLengths(void)
+{
+    CborItem item;
+
+    /* indefinite byte string, text, array and map are not supported */
+    assert(Skip(BUFFER(0x5F, 0x41, 'a', 0xFF), NULL) == FAILURE);
+    assert(Skip(BUFFER(0x7F, 0x61, 'a', 0xFF), NULL) == FAILURE);
+    assert(Skip(BUFFER(0x9F, 0x01, 0xFF), NULL) == FAILURE);
+    assert(Cbor_MapFind(BUFFER(0xBF, 0x61, 'a', 0x01, 0xFF), "a", &item) == FAILURE);
+
+    /* nested inside a definite map */
+    assert(Cbor_MapFind(BUFFER(0xA2, 0x61, 'a', 0x9F, 0xFF, 0x61, 'b', 0x01), "b", &item) == FAILURE);
+
+    /* a lone break byte */
+    assert(Skip(BUFFER(0xFF), NULL) == FAILURE);
+}
+
+int main(void)
+{
+    Test_RoundTrip();
+    Test_TruncatedItems();
+    Test_OversizedLengths();
+    Test_NestingDepth();
+    Test_IndefiniteLengths();
+
+    printf("test_cbor: all tests passed\n");
+    return 0;
+}
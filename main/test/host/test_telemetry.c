@@ -0,0 +1,105 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemetry/telemetry_batch.h"
+#include "core/cbor.h"
+
+static const TelemetrySource *sources[] = {&Telemetry_SyntheticSource};
+
+/* what the sampling task does for one source */
+static void Feed(TelemetryRing *ring, size_t count, uint32_t startMs)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        TelemetrySample sample = {.timestampMs = startMs + i * 100, .sourceId = 0};
+        assert(Telemetry_SyntheticSource.read(Telemetry_SyntheticSource.ctx, &sample.value) == SUCCESS);
+        TelemetryRing_Push(ring, &sample);
+    }
+}
+
+static void Test_PeekKeepsSamplesUntilConsumed(void)
+{
+    static TelemetryRing ring;
+    memset(&ring, 0, sizeof(ring));
+    Feed(&ring, 5, 1000);
+
+    TelemetrySample samples[8];
+    assert(TelemetryRing_Peek(&ring, samples, 3) == 3);
+    assert(TelemetryRing_GetPendingCount(&ring) == 5);
+
+    /* a failed publish leaves the batch in place */
+    TelemetrySample again[8];
+    assert(TelemetryRing_Peek(&ring, again, 3) == 3);
+    assert(memcmp(samples, again, 3 * sizeof(TelemetrySample)) == 0);
+
+    TelemetryRing_Consume(&ring, 3);
+    assert(TelemetryRing_GetPendingCount(&ring) == 2);
+    assert(TelemetryRing_Peek(&ring, samples, 8) == 2);
+    assert(samples[0].timestampMs == 1300 && samples[1].timestampMs == 1400);
+}
+
+static void Test_FullRingCountsDrops(void)
+{
+    static TelemetryRing ring;
+    memset(&ring, 0, sizeof(ring));
+    Feed(&ring, TELEMETRY_RING_SIZE + 5, 0);
+
+    assert(TelemetryRing_GetPendingCount(&ring) == TELEMETRY_RING_SIZE);
+    assert(TelemetryRing_GetDroppedCount(&ring) == 5);
+
+    /* the oldest samples are kept */
+    TelemetrySample sample;
+    assert(TelemetryRing_Peek(&ring, &sample, 1) == 1 && sample.timestampMs == 0);
+}
+
+static void Test_EncodeJson(void)
+{
+    TelemetrySample samples[] = {
+        {.timestampMs = 1000, .sourceId = 0, .value = 11.8f},
+        {.timestampMs = 1100, .sourceId = 0, .value = 11.9f},
+        {.timestampMs = 1200, .sourceId = 0, .value = 12.0f},
+    };
+
+    char out[256];
+    size_t length = TelemetryBatch_Encode(sources, 1, samples, 3, out, sizeof(out));
+    const char *expected = "{\"t0\":1000,\"src\":[\"temp\"],\"s\":[[0,0,11.8],[100,0,11.9],[200,0,12]]}";
+    assert(length == strlen(expected) && strcmp(out, expected) == 0);
+
+    /* truncated output is reported as empty */
+    assert(TelemetryBatch_Encode(sources, 1, samples, 3, out, 20) == 0);
+}
+
+static void Test_EncodeCborFromSyntheticSource(void)
+{
+    static TelemetryRing ring;
+    memset(&ring, 0, sizeof(ring));
+    Feed(&ring, 10, 5000);
+
+    TelemetrySample samples[10];
+    size_t count = TelemetryRing_Peek(&ring, samples, 10);
+    assert(count == 10);
+
+    uint8_t out[256];
+    size_t length = TelemetryBatch_EncodeCbor(sources, 1, samples, count, out, sizeof(out));
+    assert(length > 0);
+
+    CBuffer encoded = {.buffer = out, .length = length};
+    CborItem item;
+    assert(Cbor_MapFind(encoded, "t0", &item) == SUCCESS && item.type == CBOR_TYPE_UINT && item.value == 5000);
+    assert(Cbor_MapFind(encoded, "src", &item) == SUCCESS && item.type == CBOR_TYPE_ARRAY && item.value == 1);
+    assert(Cbor_MapFind(encoded, "s", &item) == SUCCESS && item.type == CBOR_TYPE_ARRAY && item.value == 10);
+
+    assert(TelemetryBatch_EncodeCbor(sources, 1, samples, count, out, 16) == 0);
+}
+
+int main(void)
+{
+    Test_PeekKeepsSamplesUntilConsumed();
+    Test_FullRingCountsDrops();
+    Test_EncodeJson();
+    Test_EncodeCborFromSyntheticSource();
+
+    printf("test_telemetry: all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "net/topic_router.h"
+
+#define TOPIC(s) ((CString){.string = (s), .length = strlen(s)})
+
+static size_t exactCalls, plusCalls, hashCalls, rootHashCalls;
+
+static void OnExact(CString topic, CBuffer payload)
+{
+    (void)topic;
+    (void)payload;
+    exactCalls++;
+}
+
+static void OnPlus(CString topic, CBuffer payload)
+{
+    (void)topic;
+    (void)payload;
+    plusCalls++;
+}
+
+static void OnHash(CString topic, CBuffer payload)
+{
+    (void)topic;
+    (void)payload;
+    hashCalls++;
+}
+
+static void OnRootHash(CString topic, CBuffer payload)
+{
+    (void)topic;
+    (void)payload;
+    rootHashCalls++;
+}
+
+static size_t Dispatch(const char *topic)
+{
+    exactCalls = plusCalls = hashCalls = rootHashCalls = 0;
+    return TopicRouter_Dispatch(TOPIC(topic), (CBuffer){0});
+}
+
+static void Test_InvalidFilters(void)
+{
+    const char *invalid[] = {"", "a+b", "a/b+", "+a/b", "a/#/b", "a#", "#/a", "a/##", "a/+#"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        assert(!TopicRouter_IsValidFilter(TOPIC(invalid[i])));
+        assert(TopicRouter_Register(TOPIC(invalid[i]), OnExact) == FAILURE);
+    }
+
+    /* nothing was stored as a literal */
+    assert(Dispatch("a+b") == 0);
+    assert(Dispatch("a/#/b") == 0);
+
+    const char *valid[] = {"#", "+", "a/b", "a/+/c", "+/+", "a/#", "/", "a//b", "$SYS/#"};
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+        assert(TopicRouter_IsValidFilter(TOPIC(valid[i])));
+}
+
+static void Test_Matching(void)
+{
+    assert(TopicRouter_Register(TOPIC("management/dev/crt"), OnExact) == SUCCESS);
+    assert(TopicRouter_Register(TOPIC("management/+/crt"), OnPlus) == SUCCESS);
+    assert(TopicRouter_Register(TOPIC("management/dev/#"), OnHash) == SUCCESS);
+
+    /* one filter per handler slot */
+    assert(TopicRouter_Register(TOPIC("management/dev/crt"), OnPlus) == FAILURE);
+    assert(TopicRouter_Register(TOPIC("management/dev/#"), OnPlus) == FAILURE);
+
+    assert(Dispatch("management/dev/crt") == 3 && exactCalls == 1 && plusCalls == 1 && hashCalls == 1);
+    assert(Dispatch("management/other/crt") == 1 && plusCalls == 1);
+    assert(Dispatch("management/dev/csr_req/cbor") == 1 && hashCalls == 1);
+
+    /* '#' also matches its parent level */
+    assert(Dispatch("management/dev") == 1 && hashCalls == 1);
+
+    /* '+' matches exactly one level */
+    assert(Dispatch("management/crt") == 0);
+    assert(Dispatch("management/a/b/crt") == 0);
+    assert(Dispatch("management//crt") == 1 && plusCalls == 1);
+}
+
+static void Test_DollarTopics(void)
+{
+    assert(TopicRouter_Register(TOPIC("#"), OnRootHash) == SUCCESS);
+
+    assert(Dispatch("telemetry") == 1 && rootHashCalls == 1);
+
+    /* wildcards at the first level skip topics starting with '$' */
+    assert(Dispatch("$aws/things/dev/shadow") == 0);
+}
+
+int main(void)
+{
+    Test_InvalidFilters();
+    Test_Matching();
+    Test_DollarTopics();
+
+    printf("test_topic_router: all tests passed\n");
+    return 0;
+}
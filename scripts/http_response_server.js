@@ -0,0 +1,43 @@
+// Local stand-in for the challenge response server.
+// usage: node http_response_server.js [port]
+// point CONFIG_HTTP_RESPONSE_HOST/PORT at this machine, each request logs whether its connection was reused
+const http = require("http");
+
+const port = Number(process.argv[2] || 3000);
+let connections = 0;
+
+const server = http.createServer((req, res) => {
+  let body = "";
+  req.on("data", (chunk) => (body += chunk));
+  req.on("end", () => {
+    const socket = req.socket;
+    socket.requests = (socket.requests || 0) + 1;
+    console.log(
+      `${new Date().toISOString()} ${req.method} ${req.url} connection=${socket.id} request=${socket.requests} body=${body}`
+    );
+
+    if (req.method !== "POST" || req.url !== "/response") {
+      res.writeHead(404).end();
+      return;
+    }
+
+    try {
+      JSON.parse(body);
+    } catch (err) {
+      res.writeHead(400).end();
+      return;
+    }
+
+    res.writeHead(200, { "Content-Type": "application/json" }).end("{}");
+  });
+});
+
+server.on("connection", (socket) => {
+  socket.id = ++connections;
+  console.log(`connection ${socket.id} opened by ${socket.remoteAddress}`);
+  socket.on("close", () => console.log(`connection ${socket.id} closed`));
+});
+
+// longer than CONFIG_HTTP_IDLE_TIMEOUT_MS so the device closes first
+server.keepAliveTimeout = 60000;
+server.listen(port, () => console.log(`listening on ${port}`));
@@ -0,0 +1,56 @@
+// Convert the output of the console "trace" command to the Chrome trace event format.
+// usage: node trace_to_chrome.js <dump.txt> [trace.json]
+// open the result in chrome://tracing or https://ui.perfetto.dev
+const fs = require("fs");
+
+const [input, output = "trace.json"] = process.argv.slice(2);
+if (!input) {
+  console.error("usage: node trace_to_chrome.js <dump.txt> [trace.json]");
+  process.exit(1);
+}
+
+const traceEvents = [];
+let version = "unknown";
+
+for (const line of fs.readFileSync(input, "utf8").split(/\r?\n/)) {
+  const fields = Object.fromEntries(
+    line
+      .trim()
+      .split(/\s+/)
+      .slice(1)
+      .map((field) => field.split("="))
+      .filter((pair) => pair.length === 2)
+  );
+
+  if (line.startsWith("trace ") && fields.version) {
+    version = fields.version;
+  } else if (line.startsWith("trace ") && fields.overwritten > 0) {
+    console.warn(`${fields.overwritten} spans were overwritten, enlarge TRACE_RING_SIZE`);
+  } else if (line.startsWith("span ")) {
+    traceEvents.push({
+      name: fields.name,
+      ph: "X",
+      ts: Number(fields.start_us),
+      dur: Number(fields.dur_us),
+      pid: 0,
+      tid: Number(fields.core),
+    });
+  }
+}
+
+traceEvents.sort((a, b) => a.ts - b.ts);
+
+// label process and threads
+traceEvents.unshift(
+  { name: "process_name", ph: "M", pid: 0, args: { name: `firmware ${version}` } },
+  ...[...new Set(traceEvents.map((event) => event.tid))].map((tid) => ({
+    name: "thread_name",
+    ph: "M",
+    pid: 0,
+    tid,
+    args: { name: `core ${tid}` },
+  }))
+);
+
+fs.writeFileSync(output, JSON.stringify({ traceEvents, displayTimeUnit: "ms" }, null, 2));
+console.log(`${traceEvents.length} events written to ${output}`);